@@ -27,19 +27,119 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include "common.h"
 
 #include "json-parser.h"
 
-char shm_name[] = {0};
+char shm_name[16] = {0};
 
+// number of builtins loaded (using the shared memory)
 int count = 0;
 
+// the shared memory, mapped once per process (forks inherit it)
+static void *_shm = NULL;
+// how to create it (see `shmem_open`)
+static int _shm_flags = 0;
+// lock held by the running builtin (see `run_locked`), 0 if none
+static int _lock_mode = 0;
+// what it read from stdin holding the read lock, given back when it
+// runs again with the write one (see `EX_NEEDS_WRITE`), 0 if nothing
+#define STDIN_KEPT_HANDLER	1
+#define STDIN_KEPT_BUFFER	2
+static int _stdin_kept = 0;
+static long _stdin_handler;
+static char *_stdin_buf = NULL;
+static size_t _stdin_len;
+// automatic collection (see `_gc_due`), 0 if not enabled
+static unsigned long _gc_threshold = 0;
+static unsigned long _gc_next = 0;
+
+// standard output buffer (see `out_write`)
+#define OUT_BUFFER_SIZE (64 << 10)
+static char _out_buffer[OUT_BUFFER_SIZE];
+static size_t _out_len = 0;
+// errno of the first failed write, 0 if none
+static int _out_errno = 0;
+
+// positional parameters, from bash
+extern char *dollar_vars[];
+extern WORD_LIST *rest_of_args;
+// the callers' ones are saved (out of reach) while in a function or a
+// sourced file, and in `BASH_ARGV` too with `shopt -s extdebug`
+extern int variable_context;
+extern int sourcelevel;
+extern int debugging_mode;
+// background jobs (and coprocs) not finished yet
+extern int count_all_jobs(void);
+
+int parse_size(char *s, unsigned long *size)
+{
+	char *end;
+	if(!isdigit(*s))
+		return -1;
+	*size = strtoul(s, &end, 10);
+	switch(*end)
+	{
+	case 'g': case 'G': *size <<= 10;
+	case 'm': case 'M': *size <<= 10;
+	case 'k': case 'K': *size <<= 10;
+		end++;
+	}
+	return *end ? -1 : 0;
+}
+
+/*
+	number from a shell variable, with an optional k/m/g suffix (for sizes)
+
+	returns 0 if not set (or invalid)
+*/
+static unsigned long _number_var(char *name)
+{
+	char *value = get_string_value(name);
+	unsigned long size;
+	if(!value || !*value)
+		return 0;
+	if(parse_size(value, &size))
+	{
+		PE("invalid size in %s: '%s'", name, value);
+		return 0;
+	}
+	return size;
+}
+
+// 1 if the shell variable is set to `value`
+static int _is_var(char *name, char *value)
+{
+	char *v = get_string_value(name);
+	return v && !strcmp(v, value);
+}
+
 __attribute__((constructor))
 void _j_builtins_init(void)
 {
 	sprintf(shm_name, "/%lu", getpid());
+
+	// shared memory growth policy
+	shmem_configure(
+		_number_var("BASH_JSON_RESERVE"),
+		_number_var("BASH_JSON_GROW_MIN"),
+		_number_var("BASH_JSON_GROW_PERCENT")
+	);
+
+	// backing memory, a memfd is only seen by the forks (subshells)
+	if(_is_var("BASH_JSON_BACKING", "memfd"))
+		_shm_flags |= SHMEM_MEMFD;
+	if(_is_var("BASH_JSON_HUGEPAGES", "thp"))
+		_shm_flags |= SHMEM_THP;
+	else if(_is_var("BASH_JSON_HUGEPAGES", "hugetlb"))
+		_shm_flags |= SHMEM_HUGETLB;
+
+	_gc_threshold = _gc_next = _number_var("BASH_JSON_GC");
 }
 
 __attribute__((destructor))
@@ -51,41 +151,291 @@ void _j_builtins_fini(void)
 
 int init_top_level(void)
 {
+	if(!_shm && !(_shm = shmem_open(shm_name, _shm_flags)))
+		return 1;
+	count++;
 	return 0;
 }
 
 
 void fini_top_level(void)
 {
-	return ;
+	if(count && !--count && _shm)
+	{
+		shmem_fini(_shm);
+		_shm = NULL;
+	}
+}
+
+static void *_open_shm(void)
+{
+	// in case it wasn't loaded with the builtins
+	if(!_shm)
+		_shm = shmem_open(shm_name, _shm_flags);
+	return _shm;
+}
+
+void *get_shm(void)
+{
+	if(!_open_shm())
+		return NULL;
+	// another process (a subshell) may have changed it
+	if(shmem_sync(_shm))
+		return NULL;
+	return _shm;
 }
 
+/*
+	automatic collection (`BASH_JSON_GC`), before the builtins that change
+	the shared memory, once it grew past the threshold
+
+	only in the shell itself (subshells don't have its variables), and
+	not when stdin is a pipe, it may bring handlers not in any variable,
+	nor when some of these can't be seen:
+	- the positional parameters of the callers, in a function or sourced
+	  file (unless these are in `BASH_ARGV`)
+	- the variables of background jobs and coprocs, still running
+*/
+static int _gc_due(void *shm)
+{
+	struct stat st;
+	if(!_gc_next || getpid() != atol(shm_name+1))
+		return 0;
+	if(!fstat(fileno(stdin), &st) && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+		return 0;
+	if((variable_context || sourcelevel) && !debugging_mode)
+		return 0;
+	if(count_all_jobs())
+		return 0;
+	return !shmem_sync(shm) && shmem_size(shm) > _gc_next;
+}
+
+/*
+	write all of it to the standard output, straight to the file
+	descriptor (stdio's own buffer goes first), 0 or errno
+*/
+static int _out_writev(struct iovec *iov, int n)
+{
+	if(fflush(stdout))
+		return errno;
+	while(n > 0)
+	{
+		ssize_t w = writev(STDOUT_FILENO, iov, n);
+		if(w < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			return errno;
+		}
+		// skip what was written, possibly part of a vector
+		while(n > 0 && (size_t)w >= iov->iov_len)
+		{
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if(n > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+	return 0;
+}
+
+void out_write(const char *data, size_t size)
+{
+	if(_out_len + size <= OUT_BUFFER_SIZE)
+	{
+		memcpy(_out_buffer + _out_len, data, size);
+		_out_len += size;
+		return;
+	}
+	// full, the buffer and the data (not copied) in one go
+	struct iovec iov[2] = {
+		{ _out_buffer, _out_len },
+		{ (char*)data, size },
+	};
+	int e = _out_writev(iov, 2);
+	if(e && !_out_errno)
+		_out_errno = e;
+	_out_len = 0;
+}
+
+void out_char(char c)
+{
+	if(_out_len == OUT_BUFFER_SIZE)
+		out_write(&c, 1);
+	else
+		_out_buffer[_out_len++] = c;
+}
+
+int out_dump(const char *data, size_t size, void *unused)
+{
+	out_write(data, size);
+	return 0;
+}
+
+void out_number(long n)
+{
+	char buf[JSON_NUMBER_BUFFER_SIZE];
+	out_write(buf, json_format_int64(n, buf));
+	out_char('\n');
+}
+
+int out_flush(void)
+{
+	if(_out_len)
+	{
+		struct iovec iov = { _out_buffer, _out_len };
+		int e = _out_writev(&iov, 1);
+		if(e && !_out_errno)
+			_out_errno = e;
+		_out_len = 0;
+	}
+	if(!_out_errno)
+		return 0;
+	errno = _out_errno;
+	_out_errno = 0;
+	return -1;
+}
+
+static int _run_locked(int mode, int (*builtin)(WORD_LIST *), WORD_LIST *list)
+{
+	void *shm = _open_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+	if(shmem_lock(shm, mode))
+	{
+		PE("failed to lock shared memory");
+		return EXECUTION_FAILURE;
+	}
+	_lock_mode = mode;
+	if(mode == SHMEM_LOCK_WRITE && _gc_due(shm) && collect_handlers(shm, list) >= 0)
+	{
+		// next time when it doubles
+		unsigned long size = shmem_size(shm) << 1;
+		_gc_next = size > _gc_threshold ? size : _gc_threshold;
+	}
+	// anything left over by an interrupted builtin
+	_out_len = 0;
+	int ret = builtin(list);
+	_lock_mode = 0;
+	shmem_unlock(shm, mode);
+	if(ret == EX_NEEDS_WRITE)
+	{
+		// it runs again, nothing was printed yet
+		_out_len = 0;
+		return ret;
+	}
+	// the output is written without holding the lock
+	if(out_flush())
+	{
+		PE("write error: %s", strerror(errno));
+		if(ret == EXECUTION_SUCCESS)
+			ret = EXECUTION_FAILURE;
+	}
+	return ret;
+}
+
+int run_locked(int mode, int (*builtin)(WORD_LIST *), WORD_LIST *list)
+{
+	int ret = _run_locked(mode, builtin, list);
+	if(ret == EX_NEEDS_WRITE)
+		ret = _run_locked(SHMEM_LOCK_WRITE, builtin, list);
+	if(ret == EX_NEEDS_WRITE)
+		// not from one holding the write lock
+		ret = EXECUTION_FAILURE;
+	_stdin_kept = 0;
+	free(_stdin_buf);
+	_stdin_buf = NULL;
+	return ret;
+}
+
+int read_locked(void)
+{
+	return _lock_mode == SHMEM_LOCK_READ;
+}
+
+/*
+	stdin and FIFOs may be fed by another builtin (in a pipeline or
+	a process substitution) waiting for the lock, so it's not held
+	while reading them
+*/
+static void _unlocked_begin(void)
+{
+	if(_lock_mode)
+		shmem_unlock(_shm, _lock_mode);
+}
+
+static int _unlocked_end(void)
+{
+	if(_lock_mode && shmem_lock(_shm, _lock_mode))
+	{
+		// not holding it anymore
+		_lock_mode = 0;
+		return 1;
+	}
+	// someone else may have grown it meanwhile
+	if(_lock_mode)
+		shmem_sync(_shm);
+	return 0;
+}
 
 int is_handler(char *s)
 {
 	return s[0] == 'j' && s[1] == ':';
 }
 
+/*
+	handlers are ids, look up the object
+*/
+static long _resolve_handler(long id)
+{
+	void *shm = get_shm();
+	if(!shm)
+		return -1;
+	return j_handle_get(shm, id);
+}
+
 long get_handler(char *s)
 {
 	long r = atol(s+2);
 	if(!r)
 		return -1;
-	return r;
+	return _resolve_handler(r);
 }
 
 long get_handler_stdin(void)
 {
 	long r;
-	if(scanf("j:%ld", &r)<1)
-		return -1;
+	if(_stdin_kept == STDIN_KEPT_HANDLER)
+		r = _stdin_handler;
+	else
+	{
+		_unlocked_begin();
+		int n = scanf("j:%ld", &r);
+		if(_unlocked_end() || n<1)
+			return -1;
+		if(read_locked())
+		{
+			// in case it needs to run again
+			_stdin_handler = r;
+			_stdin_kept = STDIN_KEPT_HANDLER;
+		}
+	}
 	PD("handler is %ld", r);
-	return r;
+	return _resolve_handler(r);
 }
 
 static int _do_print(const char *data, size_t size, void *unused)
 {
-	return printf("%.*s\n", size, data) != (size+1);
+	out_write(data, size);
+	out_char('\n');
+	return 0;
 }
 
 static int _do_print_str(const char *data, size_t size, void *unused)
@@ -94,77 +444,245 @@ static int _do_print_str(const char *data, size_t size, void *unused)
 	if(data[0] == '"')
 	{
 		if(*v != 0)
-			putchar(10);
+			out_char('\n');
 		(*v) ++;
 		return 0;
 	}
 	// skip quotes when printing strings
-	return printf("%.*s", size, data) != (size);
+	out_write(data, size);
+	return 0;
 }
 
 void print_handler(void *shm, long obj)
 {
+	char buf[JSON_NUMBER_BUFFER_SIZE];
 	switch(j_type(shm, obj))
 	{
 	case JTYPE_DICT:
-	case JTYPE_LIST:
-		printf("j:%ld\n", obj);
+	case JTYPE_LIST: {
+		long handle = j_handle(shm, obj);
+		if(handle < 0)
+		{
+			PE("failed to create handler");
+			break;
+		}
+		out_write("j:", 2);
+		out_write(buf, json_format_int64(handle, buf));
+		out_char('\n');
 		break;
+	}
 	case JTYPE_NULL:
-		puts("null");
+		out_write("null\n", 5);
 		break;
 	case JTYPE_FALSE:
-		puts("false");
+		out_write("false\n", 6);
 		break;
 	case JTYPE_TRUE:
-		puts("true");
+		out_write("true\n", 5);
 		break;
 	case JTYPE_INT:
-		printf("%ld\n", j_int_val(shm, obj));
+		out_write(buf, json_format_int64(j_int_val(shm, obj), buf));
+		out_char('\n');
 		break;
 	case JTYPE_FLOAT:
 		json_dump_double(j_float_val(shm, obj), _do_print, NULL);
 		break;
 	case JTYPE_STR: {
-		char *s = j_str_val(shm, obj);
+		int len;
+		char *s = j_str_val(shm, obj, &len);
 		int c = 0;
-		int r = json_dump_string(s, strlen(s), _do_print_str, &c);
+		json_dump_string(s, len, _do_print_str, &c);
 		break;
 	}
 	}
 }
 
-char *read_stdin_all(int *len)
+long get_value(void *shm, char *s)
+{
+	long value = -1;
+	// check handler
+	if(is_handler(s))
+		value = get_handler(s);
+	if(value >= 0)
+		// shared, not copied
+		return j_ref(shm, value);
+	// check JSON string
+	if(value < 0)
+		value = j_parse_buffer(shm, s, strlen(s), J_PARSE_QUIET);
+	// fallback to string literal
+	if(value < 0)
+		value = j_str_new(shm, s);
+	return value;
+}
+
+// mark the slots of the handlers (`j:<id>`) anywhere in the string
+static void _mark_handlers(void *shm, char *s, char *marks)
+{
+	while(s && (s = strstr(s, "j:")))
+	{
+		s += 2;
+		if(!isdigit(*s))
+			continue;
+		char *end;
+		long slot = j_handle_slot(shm, strtol(s, &end, 10));
+		if(slot > 0)
+			marks[slot] = 1;
+		s = end;
+	}
+}
+
+static void _mark_words(void *shm, WORD_LIST *words, char *marks)
+{
+	for(; words; words = words->next)
+		_mark_handlers(shm, words->word->word, marks);
+}
+
+long collect_handlers(void *shm, WORD_LIST *keep)
+{
+	long max = j_handle_max(shm);
+	char *marks = calloc(max+1, 1);
+	if(!marks)
+		return -1;
+	SHELL_VAR **vars = all_shell_variables();
+	for(int i = 0; vars && vars[i]; i++)
+	{
+		SHELL_VAR *v = vars[i];
+		if(array_p(v))
+		{
+			WORD_LIST *words = array_to_word_list(array_cell(v));
+			_mark_words(shm, words, marks);
+			dispose_words(words);
+		}
+		else if(assoc_p(v))
+		{
+			// handlers can be keys too
+			WORD_LIST *words = assoc_to_word_list(assoc_cell(v));
+			_mark_words(shm, words, marks);
+			dispose_words(words);
+			words = assoc_keys_to_word_list(assoc_cell(v));
+			_mark_words(shm, words, marks);
+			dispose_words(words);
+		}
+		else
+			_mark_handlers(shm, value_cell(v), marks);
+	}
+	free(vars);
+	for(int i = 1; i < 10; i++)
+		_mark_handlers(shm, dollar_vars[i], marks);
+	_mark_words(shm, rest_of_args, marks);
+	_mark_words(shm, keep, marks);
+
+	long released = 0;
+	for(long slot = 1; slot <= max; slot++)
+	{
+		long id = j_handle_at(shm, slot);
+		if(id > 0 && !marks[slot] && !j_handle_drop(shm, id))
+			released++;
+	}
+	free(marks);
+	return released;
+}
+
+static char *_read_all(FILE *f, size_t *len, size_t max)
 {
-	char *ptr = (char*)malloc(128);
+	size_t size = 4096;
+	size_t read = 0;
+	int error = 0;
+	char *ptr = (char*)malloc(size);
 	if(!ptr)
 		return NULL;
-	int read = 0;
-	int size = 128;
-	while(!feof(stdin))
+	while(!feof(f))
 	{
 		// always leave space for an extra NULL byte
-		int part = fread(ptr+read, 1, 127, stdin);
-		read += part;
-		if(part<127)
+		if(read + 1 == size)
 		{
-			if(ferror(stdin))
+			char *nptr = (char*)realloc(ptr, size << 1);
+			if(!nptr)
 			{
-				free(ptr);
-				return NULL;
+				error = errno;
+				break;
 			}
+			ptr = nptr;
+			size <<= 1;
+		}
+		read += fread(ptr+read, 1, size-read-1, f);
+		if(ferror(f))
+		{
+			error = errno;
 			break;
 		}
-		char *nptr = (char*)realloc(ptr, size+part);
-		if(!nptr)
+		// stop as soon as it's too much, not when it's all in memory
+		if(max && read > max)
 		{
-			free(ptr);
-			return NULL;
+			error = EFBIG;
+			break;
 		}
-		memset(ptr+size, 0, part);
-		size += part;
-		ptr = nptr;
 	}
+	if(error || !feof(f))
+	{
+		free(ptr);
+		errno = error;
+		return NULL;
+	}
+	ptr[read] = 0;
 	*len = read;
 	return ptr;
 }
+
+char *read_stdin_all(size_t *len, size_t max)
+{
+	if(_stdin_kept == STDIN_KEPT_BUFFER)
+	{
+		// it's the caller's now
+		char *ptr = _stdin_buf;
+		*len = _stdin_len;
+		_stdin_buf = NULL;
+		_stdin_kept = 0;
+		return ptr;
+	}
+	_unlocked_begin();
+	char *ptr = _read_all(stdin, len, max);
+	int error = errno;
+	if(_unlocked_end())
+	{
+		free(ptr);
+		return NULL;
+	}
+	if(ptr && read_locked())
+	{
+		// in case it needs to run again
+		_stdin_buf = (char*)malloc(*len + 1);
+		if(_stdin_buf)
+		{
+			memcpy(_stdin_buf, ptr, *len + 1);
+			_stdin_len = *len;
+			_stdin_kept = STDIN_KEPT_BUFFER;
+		}
+	}
+	errno = error;
+	return ptr;
+}
+
+char *read_file_all(char *path, size_t *len, size_t max)
+{
+	char *ptr = NULL;
+	int error;
+	_unlocked_begin();
+	// opening a FIFO blocks until the writer shows up
+	FILE *f = fopen(path, "r");
+	if(f)
+	{
+		ptr = _read_all(f, len, max);
+		error = errno;
+		fclose(f);
+	}
+	else
+		error = errno;
+	if(_unlocked_end())
+	{
+		free(ptr);
+		return NULL;
+	}
+	errno = error;
+	return ptr;
+}
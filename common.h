@@ -54,16 +54,79 @@
 
 extern char shm_name[16];
 
+// called from the load/unload functions, maps the shared memory once
 int init_top_level(void);
 void fini_top_level(void);
 
+// shared memory handler, up to date with other processes, NULL on failure
+void *get_shm(void);
+
+/*
+	run the builtin holding the shared memory lock, SHMEM_LOCK_READ
+	for the ones that only read, SHMEM_LOCK_WRITE for the others
+
+	the lock is not held while reading stdin
+*/
+int run_locked(int mode, int (*builtin)(WORD_LIST *), WORD_LIST *list);
+
+/*
+	returned by builtins holding the read lock that find they have to
+	change something (give a handler, unshare, parse a value), before
+	printing or changing anything, these run again with the write lock
+	(and get what they read from stdin again)
+*/
+#define EX_NEEDS_WRITE	(-2)
+// 1 if the builtin holds just the read lock
+int read_locked(void);
+
 // 1 if is handler
 int is_handler(char *s);
-// get handler, fail if is not
+// get the object of a handler, -1 if it's not (valid)
 long get_handler(char *s);
 long get_handler_stdin(void);
+/*
+	a value from an argument: handler, JSON or else a string, -1 on failure,
+	with a reference for the caller (to give to a container, or `j_free`)
+*/
+long get_value(void *shm, char *s);
+
+/*
+	all of stdin (with an extra NULL byte), up to `max` bytes (0 for
+	no limit), NULL on failure, with errno EFBIG if it's larger
+*/
+char *read_stdin_all(size_t *len_out, size_t max);
+
+// the same for a file, opened and read without holding the lock
+char *read_file_all(char *path, size_t *len_out, size_t max);
+
+// a size, with an optional k/m/g suffix, -1 if invalid
+int parse_size(char *s, unsigned long *size);
+
+/*
+	release the handlers not found in the shell variables (arrays too),
+	the positional parameters or `keep`, what only these had is freed
+
+	the callers' positional parameters (in a function) are only seen
+	in `BASH_ARGV` (with `shopt -s extdebug`), and background jobs'
+	variables not at all
 
-char *read_stdin_all(int *len_out);
+	returns how many, -1 on failure
+*/
+long collect_handlers(void *shm, WORD_LIST *keep);
+
+/*
+	buffered standard output, written (with `writev`, after stdio's
+	buffer) when it's full and once `run_locked` returns, don't mix
+	with stdio in the same builtin
+*/
+void out_write(const char *data, size_t size);
+void out_char(char c);
+// `out_write` as a `JSON_DUMP_CALLBACK`, never fails
+int out_dump(const char *data, size_t size, void *unused);
+// a number, and a newline
+void out_number(long n);
+// write what's buffered, -1 (with errno) if any write failed since the last
+int out_flush(void);
 
 // will print handler
 // wither a j:xx for complex types, or the value from the object for simple types
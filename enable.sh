@@ -3,10 +3,13 @@
 # builtins to load
 BUILTINS=(
 	jload
+	junload
+	jgc
 	jprint
 	jhandler
 
 	jnew
+	jcopy
 	jtype
 	jget
 	jset
@@ -14,11 +17,20 @@ BUILTINS=(
 
 	jlen
 	jcmp
+	jhash
 
 	jkeys
 	jvalues
 	jhaskey
 	jhasval
+
+	jpush
+	jpop
+	jshift
+	junshift
+
+	jcompact
+	jstat
 )
 
 # where the SO is
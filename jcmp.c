@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jcmp_builtin(WORD_LIST *list)
+static int _jcmp_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -38,7 +38,7 @@ int jcmp_builtin(WORD_LIST *list)
 			return EX_USAGE;
 
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -48,6 +48,20 @@ int jcmp_builtin(WORD_LIST *list)
 	long obj_a = -1, obj_b = -1;
 	int free_a = 0, free_b = 0;
 
+	// read it before getting anything from the memory, the lock
+	// is released meanwhile (see `run_locked`)
+	char *stdin_str = NULL;
+	size_t slen = 0;
+	if(!list->next && !isatty(fileno(stdin)))
+	{
+		if(!(stdin_str = read_stdin_all(&slen, 0)))
+		{
+			PE("unable to read from STDIN");
+			goto _fail;
+		}
+		PD("from stdin (%zu) '%s'", slen, stdin_str);
+	}
+
 	// one of the arguments is always from CLI
 	{
 		char *obj_str = list->word->word;
@@ -55,10 +69,13 @@ int jcmp_builtin(WORD_LIST *list)
 		{
 			obj_a = get_handler(obj_str);
 		}
+		if(obj_a < 0 && read_locked())
+			// parsing takes the write lock
+			goto _write;
 		if(obj_a < 0)
 		{
 			// try JSON literal
-			obj_a = j_parse_buffer(shm, obj_str, strlen(obj_str), 1);
+			obj_a = j_parse_buffer(shm, obj_str, strlen(obj_str), J_PARSE_QUIET);
 			free_a = 1;
 		}
 		if(obj_a < 0)
@@ -82,9 +99,11 @@ int jcmp_builtin(WORD_LIST *list)
 		{
 			obj_b = get_handler(obj_str);
 		}
+		if(obj_b < 0 && read_locked())
+			goto _write;
 		if(obj_b < 0)
 		{
-			obj_b = j_parse_buffer(shm, obj_str, strlen(obj_str), 1);
+			obj_b = j_parse_buffer(shm, obj_str, strlen(obj_str), J_PARSE_QUIET);
 			free_b = 1;
 		}
 		if(obj_b < 0)
@@ -101,26 +120,19 @@ int jcmp_builtin(WORD_LIST *list)
 			goto _fail;
 		}
 	}
-	else if(!isatty(fileno(stdin)))
+	else if(stdin_str)
 	{
-		// read from stdin, tricky this one
-		int slen = 0;
-		char *obj_str = read_stdin_all(&slen);
-		if(!obj_str)
-		{
-			PE("unable to allocate memory");
-			if(free_a)
-				j_free(shm, obj_a);
-			goto _fail;
-		}
-		PD("from stdin (%d) '%s'", slen, obj_str);
+		// from stdin, tricky this one
+		char *obj_str = stdin_str;
 		if(is_handler(obj_str))
 		{
 			obj_b = get_handler(obj_str);
 		}
+		if(obj_b < 0 && read_locked())
+			goto _write;
 		if(obj_b < 0)
 		{
-			obj_b = j_parse_buffer(shm, obj_str, slen, 1);
+			obj_b = j_parse_buffer_limits(shm, obj_str, slen, J_PARSE_QUIET, NULL);
 			free_b = 1;
 		}
 		if(obj_b < 0)
@@ -130,6 +142,7 @@ int jcmp_builtin(WORD_LIST *list)
 			free_b = 1;
 		}
 		free(obj_str);
+		stdin_str = NULL;
 		if(obj_b < 0)
 		{
 			PE("unable to get JSON object from STDIN");
@@ -152,22 +165,39 @@ int jcmp_builtin(WORD_LIST *list)
 	if(free_a) j_free(shm, obj_a);
 	if(free_b) j_free(shm, obj_b);
 
-	shmem_fini(shm);
-
 	if(result)
 		return EXECUTION_FAILURE;
 
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
+_write:
+	// nothing was parsed yet (see `run_locked`)
+	free(stdin_str);
+	return EX_NEEDS_WRITE;
 _fail:
-	shmem_fini(shm);
+	free(stdin_str);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jcmp_builtin(WORD_LIST *list)
+{
+	// values that are not handlers take the write lock, to parse them
+	return run_locked(SHMEM_LOCK_READ, _jcmp_builtin, list);
+}
+
+int jcmp_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jcmp_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jcmp_doc[] = {
 	"jcmp <JSON|handler> <JSON|handler>",
@@ -0,0 +1,102 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "common.h"
+
+static int _jcompact_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+	if(loptend)
+	{
+		builtin_usage();
+		return EX_USAGE;
+	}
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	// objects are copied here, then copied back
+	void *to = shmem_open("bash-json.compact", SHMEM_MEMFD);
+	if(!to)
+	{
+		PE("failed to create shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	long reclaimed = j_compact(shm, to);
+	shmem_fini(to);
+	if(reclaimed < 0)
+	{
+		PE("failed to compact");
+		return EXECUTION_FAILURE;
+	}
+	out_number(reclaimed);
+
+	return EXECUTION_SUCCESS;
+}
+
+int jcompact_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jcompact_builtin, list);
+}
+
+int jcompact_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jcompact_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jcompact_doc[] = {
+	"jcompact",
+	"",
+	"moves the JSON objects together, freeing the space",
+	"between them, and shrinks the shared memory.",
+	"handlers stay the same, objects without handlers",
+	"(and not inside others that have) are dropped.",
+	"prints the number of bytes reclaimed",
+	NULL
+};
+
+struct builtin jcompact_struct = {
+	"jcompact",
+	jcompact_builtin,
+	BUILTIN_ENABLED,
+	jcompact_doc,
+	"jcompact",
+	0
+};
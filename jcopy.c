@@ -0,0 +1,111 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "common.h"
+
+static int _jcopy_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+
+	list = loptend;
+	if(list && list->next)
+		return EX_USAGE;
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	long obj;
+	if(list)
+	{
+		if(!is_handler(list->word->word))
+		{
+			PE("invalid handler");
+			return EX_USAGE;
+		}
+		obj = get_handler(list->word->word);
+	}
+	else if(!isatty(fileno(stdin)))
+		obj = get_handler_stdin();
+	else
+		return EX_USAGE;
+
+	if(obj < 0)
+	{
+		PE("invalid object handler");
+		return EX_USAGE;
+	}
+
+	long copy = j_copy(shm, obj);
+	if(copy < 0)
+	{
+		PE("failed to copy object");
+		return EXECUTION_FAILURE;
+	}
+	print_handler(shm, copy);
+	// kept by its handler
+	j_free(shm, copy);
+
+	return EXECUTION_SUCCESS;
+}
+
+int jcopy_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jcopy_builtin, list);
+}
+
+int jcopy_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jcopy_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jcopy_doc[] = {
+	"jcopy [handler]",
+	"",
+	"copy the object, returns the handler of the copy",
+	"",
+	"dicts/lists share their contents with the copy, until",
+	"one of them is changed, so it's cheap to copy big ones",
+	NULL
+};
+
+struct builtin jcopy_struct = {
+	"jcopy",
+	jcopy_builtin,
+	BUILTIN_ENABLED,
+	jcopy_doc,
+	"jcopy [handler]",
+	0
+};
@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jdel_builtin(WORD_LIST *list)
+static int _jdel_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -33,7 +33,7 @@ int jdel_builtin(WORD_LIST *list)
 	if(!list)
 		return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
@@ -50,14 +50,12 @@ int jdel_builtin(WORD_LIST *list)
 		if(list->next->next)
 		{
 			// 3+ arguments
-			shmem_fini(shm);
 			return EX_USAGE;
 		}
 		char *obj_handler = list->word->word;
 		if(!is_handler(obj_handler))
 		{
 			PE("invalid handler");
-			shmem_fini(shm);
 			return EX_USAGE;
 		}
 		obj = get_handler(obj_handler);
@@ -69,14 +67,12 @@ int jdel_builtin(WORD_LIST *list)
 	}
 	else
 	{
-		shmem_fini(shm);
 		return EX_USAGE;
 	}
 
 	if(obj<0)
 	{
 		PE("invalid object handler");
-		shmem_fini(shm);
 		return EX_USAGE;
 	}
 
@@ -84,6 +80,7 @@ int jdel_builtin(WORD_LIST *list)
 	{
 		char *key_input = list->word->word;
 		char *key = NULL;
+		int key_len;
 		if(is_handler(key_input))
 		{
 			// treat as handler
@@ -91,23 +88,22 @@ int jdel_builtin(WORD_LIST *list)
 			if(obj_key < 0)
 			{
 				PE("key is invalid JSON handler");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			if(j_type(shm, obj_key) != JTYPE_STR)
 			{
 				PE("key is not a string");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
-			key = j_str_val(shm, obj_key);
+			key = j_str_val(shm, obj_key, &key_len);
 		}
 		else
 		{
 			key = key_input;
+			key_len = strlen(key);
 		}
 
-		out = j_dict_del(shm, obj, key);
+		out = j_dict_del_len(shm, obj, key, key_len);
 	}
 	else if(j_type(shm, obj) == JTYPE_LIST)
 	{
@@ -119,13 +115,11 @@ int jdel_builtin(WORD_LIST *list)
 			if(obj_index < 0)
 			{
 				PE("index is invalid JSON handler");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			if(j_type(shm, obj_index) != JTYPE_INT)
 			{
 				PE("index is not an integer");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			index = (int)j_int_val(shm, obj_index);
@@ -137,7 +131,6 @@ int jdel_builtin(WORD_LIST *list)
 			if(*end)
 			{
 				PE("index is not an integer");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 		}
@@ -147,23 +140,34 @@ int jdel_builtin(WORD_LIST *list)
 	else
 	{
 		PE("can't `jdel` from non dict/list objects");
-		shmem_fini(shm);
 		return EXECUTION_FAILURE;
 	}
 
 	if(out)
 	{
 		PE("failed to delete");
-		shmem_fini(shm);
 		return EXECUTION_FAILURE;
 	}
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 }
 
-// no load/unload
+int jdel_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jdel_builtin, list);
+}
+
+int jdel_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jdel_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jdel_doc[] = {
 	"jdel <handler> <key|index>",
@@ -0,0 +1,122 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include "common.h"
+
+static int _jgc_builtin(WORD_LIST *list)
+{
+	int compact = 0, opt;
+
+	reset_internal_getopt();
+	while((opt = internal_getopt(list, "c")) != -1)
+	{
+		switch(opt)
+		{
+			case 'c':
+				compact = 1;
+				break;
+			CASE_HELPOPT;
+			default:
+				builtin_usage();
+				return EX_USAGE;
+		}
+	}
+	list = loptend;
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	// the arguments are kept too
+	long released = collect_handlers(shm, list);
+	if(released < 0)
+	{
+		PE("failed to collect");
+		return EXECUTION_FAILURE;
+	}
+
+	if(compact)
+	{
+		// what's left is what the handlers reach (cycles are gone too)
+		void *to = shmem_open("bash-json.compact", SHMEM_MEMFD);
+		if(!to)
+		{
+			PE("failed to create shared memory");
+			return EXECUTION_FAILURE;
+		}
+		long reclaimed = j_compact(shm, to);
+		shmem_fini(to);
+		if(reclaimed < 0)
+		{
+			PE("failed to compact");
+			return EXECUTION_FAILURE;
+		}
+	}
+	out_number(released);
+
+	return EXECUTION_SUCCESS;
+}
+
+int jgc_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jgc_builtin, list);
+}
+
+int jgc_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jgc_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jgc_doc[] = {
+	"jgc [-c] [<word>...]",
+	"",
+	"release the handlers that are not in any shell variable,",
+	"array, positional parameter or in the arguments, what",
+	"only these had is freed. With -c, it also compacts",
+	"(see `jcompact`), which frees values that reference",
+	"themselves too. Prints the number of handlers released",
+	NULL
+};
+
+struct builtin jgc_struct = {
+	"jgc",
+	jgc_builtin,
+	BUILTIN_ENABLED,
+	jgc_doc,
+	"jgc [-c] [<word>...]",
+	0
+};
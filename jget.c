@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jget_builtin(WORD_LIST *list)
+static int _jget_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -33,7 +33,7 @@ int jget_builtin(WORD_LIST *list)
 	if(!list)
 		return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
@@ -50,14 +50,12 @@ int jget_builtin(WORD_LIST *list)
 		if(list->next->next)
 		{
 			// 3+ arguments
-			shmem_fini(shm);
 			return EX_USAGE;
 		}
 		char *obj_handler = list->word->word;
 		if(!is_handler(obj_handler))
 		{
 			PE("invalid handler");
-			shmem_fini(shm);
 			return EX_USAGE;
 		}
 		obj = get_handler(obj_handler);
@@ -69,21 +67,29 @@ int jget_builtin(WORD_LIST *list)
 	}
 	else
 	{
-		shmem_fini(shm);
 		return EX_USAGE;
 	}
 
 	if(obj<0)
 	{
 		PE("invalid object handler");
-		shmem_fini(shm);
 		return EX_USAGE;
 	}
 
+	// what it gives out is its own, not of its copies (see `jcopy`)
+	if(read_locked() && j_unshare_needed(shm, obj))
+		return EX_NEEDS_WRITE;
+	if(j_unshare(shm, obj))
+	{
+		PE("failed to unshare object");
+		return EXECUTION_FAILURE;
+	}
+
 	if(j_type(shm, obj) == JTYPE_DICT)
 	{
 		char *key_input = list->word->word;
 		char *key = NULL;
+		int key_len;
 		if(is_handler(key_input))
 		{
 			// treat as handler
@@ -91,23 +97,22 @@ int jget_builtin(WORD_LIST *list)
 			if(obj_key < 0)
 			{
 				PE("key is invalid JSON handler");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			if(j_type(shm, obj_key) != JTYPE_STR)
 			{
 				PE("key is not a string");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
-			key = j_str_val(shm, obj_key);
+			key = j_str_val(shm, obj_key, &key_len);
 		}
 		else
 		{
 			key = key_input;
+			key_len = strlen(key);
 		}
 
-		out = j_dict_get(shm, obj, key);
+		out = j_dict_get_len(shm, obj, key, key_len);
 	}
 	else if(j_type(shm, obj) == JTYPE_LIST)
 	{
@@ -119,13 +124,11 @@ int jget_builtin(WORD_LIST *list)
 			if(obj_index < 0)
 			{
 				PE("index is invalid JSON handler");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			if(j_type(shm, obj_index) != JTYPE_INT)
 			{
 				PE("index is not an integer");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 			index = (int)j_int_val(shm, obj_index);
@@ -137,7 +140,6 @@ int jget_builtin(WORD_LIST *list)
 			if(*end)
 			{
 				PE("index is not an integer");
-				shmem_fini(shm);
 				return EXECUTION_FAILURE;
 			}
 		}
@@ -147,25 +149,39 @@ int jget_builtin(WORD_LIST *list)
 	else
 	{
 		PE("can't `jget` from non dict/list objects");
-		shmem_fini(shm);
 		return EXECUTION_FAILURE;
 	}
 
 	if(out < 0)
 	{
 		PE("not found");
-		shmem_fini(shm);
 		return EXECUTION_FAILURE;
 	}
+	if(read_locked() && j_handle_needed(shm, out))
+		return EX_NEEDS_WRITE;
 
 	print_handler(shm, out);
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 }
 
-// no load/unload
+int jget_builtin(WORD_LIST *list)
+{
+	// giving a handler, or unsharing (see `jcopy`), takes the write lock
+	return run_locked(SHMEM_LOCK_READ, _jget_builtin, list);
+}
+
+int jget_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jget_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jget_doc[] = {
 	"jget <handler> <key|index>",
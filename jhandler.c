@@ -27,7 +27,7 @@
 
 #include "common.h"
 
-int jhandler_builtin(WORD_LIST *list)
+static int _jhandler_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -50,6 +50,11 @@ int jhandler_builtin(WORD_LIST *list)
 	return EXECUTION_FAILURE;
 }
 
+int jhandler_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jhandler_builtin, list);
+}
+
 char *jhandler_doc[] = {
 	"jhandler <handler>",
 	"",
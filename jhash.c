@@ -0,0 +1,124 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+#include "common.h"
+
+static int _jhash_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+	list = loptend;
+	if(list && list->next)
+		return EX_USAGE;
+
+	// read it before getting anything from the memory, the lock
+	// is released meanwhile (see `run_locked`)
+	char *stdin_str = NULL;
+	if(!list)
+	{
+		size_t slen;
+		if(isatty(fileno(stdin)))
+			return EX_USAGE;
+		if(!(stdin_str = read_stdin_all(&slen, 0)))
+		{
+			PE("unable to read from STDIN");
+			return EXECUTION_FAILURE;
+		}
+	}
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		free(stdin_str);
+		return EXECUTION_FAILURE;
+	}
+
+	char *str = stdin_str ? stdin_str : list->word->word;
+	long obj = -1;
+	int parsed = 0;
+	if(is_handler(str))
+		obj = get_handler(str);
+	if(obj < 0)
+	{
+		if(read_locked())
+		{
+			// parsing takes the write lock (see `run_locked`)
+			free(stdin_str);
+			return EX_NEEDS_WRITE;
+		}
+		obj = get_value(shm, str);
+		parsed = 1;
+	}
+	free(stdin_str);
+	if(obj < 0)
+	{
+		PE("unable to get JSON object");
+		return EXECUTION_FAILURE;
+	}
+
+	char buf[18];
+	out_write(buf, snprintf(buf, sizeof(buf), "%016lx\n", j_hash(shm, obj)));
+	if(parsed)
+		j_free(shm, obj);
+
+	return EXECUTION_SUCCESS;
+}
+
+int jhash_builtin(WORD_LIST *list)
+{
+	// values that are not handlers take the write lock, to parse them
+	return run_locked(SHMEM_LOCK_READ, _jhash_builtin, list);
+}
+
+int jhash_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jhash_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jhash_doc[] = {
+	"jhash <JSON|handler>",
+	"",
+	"print a hash of the contents of the value, equal values",
+	"(see `jcmp`) have the same one",
+	"",
+	"dicts/lists keep theirs, getting it again is cheap",
+	NULL
+};
+
+struct builtin jhash_struct = {
+	"jhash",
+	jhash_builtin,
+	BUILTIN_ENABLED,
+	jhash_doc,
+	"jhash <JSON|handler>",
+	0
+};
@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jhaskey_builtin(WORD_LIST *list)
+static int _jhaskey_builtin(WORD_LIST *list)
 {
 
 	if(no_options(list))
@@ -38,7 +38,7 @@ int jhaskey_builtin(WORD_LIST *list)
 		if(list->next->next)
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -47,6 +47,7 @@ int jhaskey_builtin(WORD_LIST *list)
 
 	long obj = -1;
 	char *key = NULL;
+	int key_len;
 
 	if(list->next)
 	{
@@ -90,28 +91,42 @@ int jhaskey_builtin(WORD_LIST *list)
 				PE("key is not a string");
 				goto _fail;
 			}
-			key = j_str_val(shm, key_obj);
+			key = j_str_val(shm, key_obj, &key_len);
 		}
 		else
+		{
 			key = key_input;
+			key_len = strlen(key);
+		}
 	}
 
-	if(!j_dict_haskey(shm, obj, key))
+	if(j_dict_get_len(shm, obj, key, key_len) < 0)
 		goto _fail;
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jhaskey_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jhaskey_builtin, list);
+}
+
+int jhaskey_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jhaskey_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jhaskey_doc[] = {
 	"jhaskey <handler> <key>",
@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jhasval_builtin(WORD_LIST *list)
+static int _jhasval_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -38,7 +38,7 @@ int jhasval_builtin(WORD_LIST *list)
 		if(list->next->next)
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -82,10 +82,13 @@ int jhasval_builtin(WORD_LIST *list)
 		{
 			val = get_handler(obj_str);
 		}
+		if(val < 0 && read_locked())
+			// parsing takes the write lock (see `run_locked`)
+			return EX_NEEDS_WRITE;
 		if(val < 0)
 		{
 			// try JSON literal
-			val = j_parse_buffer(shm, obj_str, strlen(obj_str), 1);
+			val = j_parse_buffer(shm, obj_str, strlen(obj_str), J_PARSE_QUIET);
 			free_val = 1;
 		}
 		if(val < 0)
@@ -121,19 +124,31 @@ int jhasval_builtin(WORD_LIST *list)
 		goto _fail;
 	// else, normal execution
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jhasval_builtin(WORD_LIST *list)
+{
+	// values that are not handlers take the write lock, to parse them
+	return run_locked(SHMEM_LOCK_READ, _jhasval_builtin, list);
+}
+
+int jhasval_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jhasval_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jhasval_doc[] = {
 	"jhasval <handler> <JSON|handler>",
@@ -25,13 +25,16 @@
 
 #include "common.h"
 
-static int _iter_dict(void *shm, char *key, long value, void *ud)
+#include "json-parser.h"
+
+static int _iter_dict(void *shm, char *key, int key_len, long value, void *ud)
 {
-	printf("%s\n", key);
+	out_write(key, key_len);
+	out_char('\n');
 	return 0;
 }
 
-int jkeys_builtin(WORD_LIST *list)
+static int _jkeys_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -40,7 +43,7 @@ int jkeys_builtin(WORD_LIST *list)
 		if(list->next)
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -81,8 +84,13 @@ int jkeys_builtin(WORD_LIST *list)
 		break;
 	case JTYPE_LIST: {
 		int len = j_list_len(shm, obj);
+		char buf[JSON_NUMBER_BUFFER_SIZE];
 		for(int i=0;i<len;i++)
-			printf("%d\n", i);
+		{
+			size_t n = json_format_int64(i, buf);
+			buf[n] = '\n';
+			out_write(buf, n+1);
+		}
 		break;
 	}
 	default:
@@ -90,19 +98,30 @@ int jkeys_builtin(WORD_LIST *list)
 		goto _fail;
 	}
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jkeys_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jkeys_builtin, list);
+}
+
+int jkeys_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jkeys_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jkeys_doc[] = {
 	"jkeys <handler>",
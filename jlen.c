@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jlen_builtin(WORD_LIST *list)
+static int _jlen_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -37,7 +37,7 @@ int jlen_builtin(WORD_LIST *list)
 			return EX_USAGE;
 	}
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -76,21 +76,32 @@ int jlen_builtin(WORD_LIST *list)
 		goto _fail;
 	}
 
-	printf("%d\n", len);
-
-	shmem_fini(shm);
+	out_number(len);
 
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jlen_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jlen_builtin, list);
+}
+
+int jlen_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jlen_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jlen_doc[] = {
 	"jlen <handler>",
@@ -27,59 +27,134 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
+#include <sys/stat.h>
 
 #include "common.h"
 
-int jload_builtin(WORD_LIST *list)
+static int _jload_builtin(WORD_LIST *list)
 {
-	if(no_options(list))
-		return EX_USAGE;
+	int flags = 0, opt;
+	struct j_parse_limits limits = {10 << 20, 64 << 10};
+
+	reset_internal_getopt();
+	while((opt = internal_getopt(list, "al:s:")) != -1)
+	{
+		switch(opt)
+		{
+			case 'a':
+				flags |= J_PARSE_ARENA;
+				break;
+			case 'l':
+				if(parse_size(list_optarg, &limits.total_len))
+				{
+					PE("invalid size: %s", list_optarg);
+					return EX_USAGE;
+				}
+				break;
+			case 's':
+				if(parse_size(list_optarg, &limits.string_len))
+				{
+					PE("invalid size: %s", list_optarg);
+					return EX_USAGE;
+				}
+				break;
+			CASE_HELPOPT;
+			default:
+				builtin_usage();
+				return EX_USAGE;
+		}
+	}
 	list = loptend;
 	if(list)
 		if(list->next)
 			// 2+ arguments
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
 		return EXECUTION_FAILURE;
 	}
 
-	FILE *target = stdin;	// default
-	if(list)
+	long object;
+	struct stat st;
+	if(list && !stat(list->word->word, &st) && S_ISREG(st.st_mode))
 	{
-		if((target = fopen(list->word->word, "r"))==NULL)
+		// regular files don't block, map them under the lock
+		FILE *target = fopen(list->word->word, "r");
+		if(target==NULL)
 		{
 			PE("failed to open file: %s", strerror(errno));
 			return EXECUTION_FAILURE;
 		}
+		object = j_parse_file_limits(shm, target, flags, &limits);
+		fclose(target);
+	}
+	else
+	{
+		// the lock can't be held while waiting for stdin or a FIFO
+		// (it may come from another builtin), so read it all first
+		size_t len = 0;
+		char *buf;
+		if(list)
+			buf = read_file_all(list->word->word, &len, limits.total_len);
+		else
+			buf = read_stdin_all(&len, limits.total_len);
+		if(!buf)
+		{
+			if(errno == EFBIG)
+				PE("input is larger than %lu bytes (see -l)", limits.total_len);
+			else if(list)
+				PE("failed to read file: %s", strerror(errno));
+			else
+				PE("failed to read from stdin");
+			return EXECUTION_FAILURE;
+		}
+		object = j_parse_buffer_limits(shm, buf, len, flags, &limits);
+		free(buf);
 	}
-
-	long object = j_parse_file(shm, target, 0);
 	if(object<0)
 	{
-		shmem_fini(shm);
 		PE("failed to load JSON");
 		return EXECUTION_FAILURE;
 	}
 
-	if(target!=stdin)
-		fclose(target);
-
 	print_handler(shm, object);
-
-	shmem_fini(shm);
+	// dicts/lists are kept by their handler, the others are gone
+	j_free(shm, object);
 
 	return EXECUTION_SUCCESS;
 }
 
+int jload_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jload_builtin, list);
+}
+
+int jload_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jload_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
 char *jload_doc[] = {
-	"jload builtin",
+	"jload [-a] [-l <size>] [-s <size>] [<file>]",
 	"",
-	"loads a JSON object from STDIN",
+	"loads a JSON object from STDIN (or <file>)",
 	"returns a JSON handler.",
+	"",
+	"with -a, the document is placed in its own arena,",
+	"faster to load and to free as a whole",
+	"",
+	"-l and -s limit the size of the document (10m by",
+	"default) and of its strings (64k), 0 for no limit",
 	NULL
 };
 
@@ -88,6 +163,6 @@ struct builtin jload_struct = {
 	jload_builtin,
 	BUILTIN_ENABLED,
 	jload_doc,
-	"jload",
+	"jload [-a] [-l <size>] [-s <size>] [<file>]",
 	0
 };
@@ -27,12 +27,12 @@
 
 #include "common.h"
 
-int jnew_builtin(WORD_LIST *list)
+static int _jnew_builtin(WORD_LIST *list)
 {
-	int type = 0, opt;
+	int type = 0, arena = 0, opt;
 
 	reset_internal_getopt();
-	while((opt = internal_getopt(list, "dl")) != -1)
+	while((opt = internal_getopt(list, "dla")) != -1)
 	{
 		switch(opt)
 		{
@@ -42,6 +42,9 @@ int jnew_builtin(WORD_LIST *list)
 			case 'l':
 				type |= 2;
 				break;
+			case 'a':
+				arena = 1;
+				break;
 			CASE_HELPOPT;
 			default:
 				builtin_usage();
@@ -60,25 +63,35 @@ int jnew_builtin(WORD_LIST *list)
 		return EX_USAGE;
 	}
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
 		return EXECUTION_FAILURE;
 	}
 
-	long obj = type == 1 ? j_dict_new(shm) : j_list_new(shm);
-	shmem_fini(shm);
+	long obj;
+	if(arena)
+		obj = j_arena_new(shm, type == 1 ? JTYPE_DICT : JTYPE_LIST);
+	else
+		obj = type == 1 ? j_dict_new(shm) : j_list_new(shm);
 	if(obj<0)
 	{
 		PE("failed to create object");
 		return EXECUTION_FAILURE;
 	}
-	printf("j:%ld\n", obj);
+	print_handler(shm, obj);
+	// kept by its handler
+	j_free(shm, obj);
 
 	return EXECUTION_SUCCESS;
 }
 
+int jnew_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jnew_builtin, list);
+}
+
 int jnew_builtin_load(char *s)
 {
 	if(init_top_level())
@@ -92,10 +105,13 @@ void jnew_builtin_unload(char *s)
 }
 
 char *jnew_doc[] = {
-	"jnew <-d|-l>",
+	"jnew [-a] <-d|-l>",
 	"",
 	"create a new dict/list (object/array) JSON handler",
 	"returns the new handler",
+	"",
+	"with -a, the object gets its own arena, freeing it",
+	"releases the arena as a whole",
 	NULL
 };
 
@@ -104,6 +120,6 @@ struct builtin jnew_struct = {
 	jnew_builtin,
 	BUILTIN_ENABLED,
 	jnew_doc,
-	"jnew <-d|-l>",
+	"jnew [-a] <-d|-l>",
 	0
 };
@@ -33,21 +33,14 @@
 
 void _print_json(void *shm, long object);
 
-
-static int _write_data(const char *data, size_t size, void *unused)
-{
-	// use `!=` to return 0 on success
-	return fwrite(data, 1, size, stdout) != size;
-}
-
-static int _print_dict(void *shm, char *key, long value, void *_ud)
+static int _print_dict(void *shm, char *key, int key_len, long value, void *_ud)
 {
 	int *l = (int*)_ud;
-	json_dump_string(key, strlen(key), _write_data, NULL);
-	putchar(':');
+	json_dump_string(key, key_len, out_dump, NULL);
+	out_char(':');
 	_print_json(shm, value);
 	if(*l != 1)
-		printf(",");
+		out_char(',');
 	(*l)--;
 	return 0;
 }
@@ -56,7 +49,7 @@ static int _print_list(void *shm, int index, long value, void *_ud)
 	int *l = (int*)_ud;
 	_print_json(shm, value);
 	if(*l != 1)
-		printf(",");
+		out_char(',');
 	(*l)--;
 	return 0;
 }
@@ -65,37 +58,37 @@ void _print_json(void *shm, long object)
 {
 	switch(j_type(shm, object))
 	{
-	case JTYPE_NULL: printf("null"); break;
-	case JTYPE_TRUE: printf("true"); break;
-	case JTYPE_FALSE: printf("false"); break;
-	case JTYPE_INT: json_dump_int64(j_int_val(shm, object), _write_data, NULL); break;
-	case JTYPE_FLOAT: json_dump_double(j_float_val(shm, object), _write_data, NULL); break;
+	case JTYPE_NULL: out_write("null", 4); break;
+	case JTYPE_TRUE: out_write("true", 4); break;
+	case JTYPE_FALSE: out_write("false", 5); break;
+	case JTYPE_INT: json_dump_int64(j_int_val(shm, object), out_dump, NULL); break;
+	case JTYPE_FLOAT: json_dump_double(j_float_val(shm, object), out_dump, NULL); break;
 	case JTYPE_STR: {
-		char *s = j_str_val(shm, object);
-		json_dump_string(s, strlen(s), _write_data, NULL);
+		int len;
+		char *s = j_str_val(shm, object, &len);
+		json_dump_string(s, len, out_dump, NULL);
 		break;
 	}
 	case JTYPE_DICT: {
 		int l = j_dict_len(shm, object);
-		printf("{");
+		out_char('{');
 		if(j_dict_iter(shm, object, _print_dict, &l))
 			return;
-		printf("}");
+		out_char('}');
 		break;
 	}
 	case JTYPE_LIST: {
 		int l = j_list_len(shm, object);
-		printf("[");
+		out_char('[');
 		if(j_list_iter(shm, object, _print_list, &l))
 			return;
-		printf("]");
+		out_char(']');
 		break;
 	}
 	}
-	fflush(stdout);
 }
 
-int jprint_builtin(WORD_LIST *list)
+static int _jprint_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -104,7 +97,7 @@ int jprint_builtin(WORD_LIST *list)
 		// only one argument
 		return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
@@ -117,7 +110,6 @@ int jprint_builtin(WORD_LIST *list)
 		char *handler = list->word->word;
 		if(!is_handler(handler))
 		{
-			shmem_fini(shm);
 			PE("invalid handler");
 			return EXECUTION_FAILURE;
 		}
@@ -130,19 +122,33 @@ int jprint_builtin(WORD_LIST *list)
 
 	if(ptr_object<0)
 	{
-		shmem_fini(shm);
 		PE("invalid handler");
 		return EXECUTION_FAILURE;
 	}
 	// output
 	_print_json(shm, ptr_object);
-	putchar(10);
-
-	shmem_fini(shm);
+	out_char('\n');
 
 	return EXECUTION_SUCCESS;
 }
 
+int jprint_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jprint_builtin, list);
+}
+
+int jprint_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jprint_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
 char *jprint_doc[] = {
 	"jprint <handler>",
 	"",
@@ -0,0 +1,121 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "common.h"
+
+static int _jpush_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+
+	list = loptend;
+	if(!list)
+		return EX_USAGE;
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	long obj;
+	if(list->next)
+	{
+		// 2+ arguments, the handler and the values
+		char *handler_str = list->word->word;
+		if(!is_handler(handler_str))
+		{
+			PE("invalid handler");
+			return EX_USAGE;
+		}
+		obj = get_handler(handler_str);
+		list = list->next;
+	}
+	else if(!isatty(fileno(stdin)))
+	{
+		obj = get_handler_stdin();
+	}
+	else
+		return EX_USAGE;
+
+	if(j_type(shm, obj) != JTYPE_LIST)
+	{
+		PE("`jpush` not valid for non list types");
+		return EXECUTION_FAILURE;
+	}
+
+	// in the order given
+	for(; list; list = list->next)
+	{
+		long value = get_value(shm, list->word->word);
+		if(value < 0)
+		{
+			PE("failed to get/create JSON object from input");
+			return EXECUTION_FAILURE;
+		}
+		if(j_list_push(shm, obj, value))
+		{
+			PE("failed to push");
+			j_free(shm, value);
+			return EXECUTION_FAILURE;
+		}
+	}
+
+	return EXECUTION_SUCCESS;
+}
+
+int jpush_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jpush_builtin, list);
+}
+
+int jpush_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jpush_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jpush_doc[] = {
+	"jpush <handler> <JSON|handler>...",
+	"",
+	"add the values to the end of the list",
+	NULL
+};
+
+struct builtin jpush_struct = {
+	"jpush",
+	jpush_builtin,
+	BUILTIN_ENABLED,
+	jpush_doc,
+	"jpush <handler> <JSON|handler>...",
+	0
+};
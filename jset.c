@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-int jset_builtin(WORD_LIST *list)
+static int _jset_builtin(WORD_LIST *list)
 {
 	/*
 	// the index, to append, may be -1, which may be confused with
@@ -48,7 +48,7 @@ int jset_builtin(WORD_LIST *list)
 			// 4+ arguments
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
@@ -59,6 +59,7 @@ int jset_builtin(WORD_LIST *list)
 	// either one of these
 	int index;
 	char *key;
+	int key_len;
 	long value = -1;
 	int obj_type;
 	if(list->next->next)
@@ -106,11 +107,14 @@ int jset_builtin(WORD_LIST *list)
 				PE("key is not a string");
 				goto _fail;
 			}
-			key = j_str_val(shm, key_obj);
+			key = j_str_val(shm, key_obj, &key_len);
 		}
 		else
+		{
 			key = key_input;
-		PD("key is %s", key);
+			key_len = strlen(key);
+		}
+		PD("key is %.*s", key_len, key);
 	}
 	else if(obj_type == JTYPE_LIST)
 	{
@@ -151,24 +155,7 @@ int jset_builtin(WORD_LIST *list)
 	list = list->next;
 
 	// the value to set
-	{
-		char *value_input = list->word->word;
-		// check handler
-		if(is_handler(value_input))
-		{
-			value = get_handler(value_input);
-		}
-		// check JSON string
-		if(value < 0)
-		{
-			value = j_parse_buffer(shm, value_input, strlen(value_input), 1);
-		}
-		// fallback to string literal (should catch the other cases on the previous branches
-		if(value < 0)
-		{
-			value = j_str_new(shm, value_input);
-		}
-	}
+	value = get_value(shm, list->word->word);
 
 	if(value < 0)
 	{
@@ -179,29 +166,41 @@ int jset_builtin(WORD_LIST *list)
 	{
 		int r;
 		if(obj_type == JTYPE_DICT)
-			r = j_dict_set(shm, obj, key, value);
+			r = j_dict_set_len(shm, obj, key, key_len, value);
 		else
 			r = j_list_set(shm, obj, index, value);
 		if(r)
 		{
 			PE("failed to set");
+			j_free(shm, value);
 			goto _fail;
 		}
 	}
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jset_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jset_builtin, list);
+}
+
+int jset_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jset_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jset_doc[] = {
 	"jset <handler> <key|index> <JSON|handler>",
@@ -0,0 +1,115 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "common.h"
+
+static int _jshift_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+
+	list = loptend;
+	if(list)
+	{
+		if(list->next)
+			return EX_USAGE;
+	}
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	long obj;
+	if(list)
+	{
+		char *handler_str = list->word->word;
+		if(!is_handler(handler_str))
+		{
+			PE("invalid handler");
+			return EX_USAGE;
+		}
+		obj = get_handler(handler_str);
+	}
+	else if(!isatty(fileno(stdin)))
+	{
+		obj = get_handler_stdin();
+	}
+	else
+		return EX_USAGE;
+
+	if(j_type(shm, obj) != JTYPE_LIST)
+	{
+		PE("`jshift` not valid for non list types");
+		return EXECUTION_FAILURE;
+	}
+
+	// empty, quietly, to end loops
+	long value = j_list_shift(shm, obj);
+	if(value < 0)
+		return EXECUTION_FAILURE;
+
+	print_handler(shm, value);
+	// dicts/lists are kept by their handler, the others are gone
+	j_free(shm, value);
+
+	return EXECUTION_SUCCESS;
+}
+
+int jshift_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _jshift_builtin, list);
+}
+
+int jshift_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jshift_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jshift_doc[] = {
+	"jshift <handler>",
+	"",
+	"remove the first value of the list, and print it",
+	"returns 1 if the list is empty",
+	NULL
+};
+
+struct builtin jshift_struct = {
+	"jshift",
+	jshift_builtin,
+	BUILTIN_ENABLED,
+	jshift_doc,
+	"jshift <handler>",
+	0
+};
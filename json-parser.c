@@ -25,7 +25,8 @@
 
 #include "json-parser.h"
 
-#include <locale.h>     /* localeconv() */
+#include <float.h>      /* FLT_EVAL_METHOD */
+#include <locale.h>     /* localeconv(), newlocale() */
 #include <stdio.h>      /* snprintf() */
 #include <stdlib.h>
 #include <string.h>
@@ -307,6 +308,221 @@ json_buf_append_codepoint(JSON_PARSER* parser, uint32_t codepoint)
 #define IS_LO_SURROGATE(codepoint)  (0xdc00 <= (codepoint)  &&  (codepoint) <= 0xdfff)
 
 
+/* Scanners for the long runs of bytes which need no special care: the plain
+ * chars of strings and the blanks between tokens (indentation).
+ *
+ * json_scan_string() returns offset of the first '\"', '\\', control char or
+ * non-ASCII byte (or `size` if there is none). json_scan_blank() returns
+ * offset of the first byte which is not ' ' nor '\t'.
+ *
+ * On x86-64 these look at 16 (SSE2) or 32 (AVX2, if the CPU has it) bytes at
+ * once. The implementation is picked on the first call.
+ */
+#if defined(__GNUC__)  &&  defined(__x86_64__)
+    #define JSON_SCAN_X86       1
+    #include <immintrin.h>
+#endif
+
+typedef size_t (*JSON_SCAN_FN)(const char* input, size_t size);
+
+static size_t
+json_scan_string_scalar(const char* input, size_t size)
+{
+    size_t off = 0;
+
+    while(off < size  &&  IS_ASCII(input[off])  &&  !IS_CONTROL(input[off])
+             &&  input[off] != '\\'  &&  input[off] != '\"')
+        off++;
+    return off;
+}
+
+static size_t
+json_scan_blank_scalar(const char* input, size_t size)
+{
+    size_t off = 0;
+
+    while(off < size  &&  (input[off] == ' '  ||  input[off] == '\t'))
+        off++;
+    return off;
+}
+
+#ifdef JSON_SCAN_X86
+static size_t
+json_scan_string_sse2(const char* input, size_t size)
+{
+    const __m128i quote = _mm_set1_epi8('\"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t off = 0;
+
+    while(off + 16 <= size) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (input + off));
+        /* Signed compare: control chars and non-ASCII bytes are below ' '. */
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                 _mm_cmplt_epi8(v, space));
+        unsigned mask = (unsigned) _mm_movemask_epi8(m);
+        if(mask != 0)
+            return off + __builtin_ctz(mask);
+        off += 16;
+    }
+    return off + json_scan_string_scalar(input + off, size - off);
+}
+
+static size_t
+json_scan_blank_sse2(const char* input, size_t size)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    size_t off = 0;
+
+    while(off + 16 <= size) {
+        __m128i v = _mm_loadu_si128((const __m128i*) (input + off));
+        unsigned mask = (unsigned) _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)));
+        if(mask != 0xffff)
+            return off + __builtin_ctz(~mask);
+        off += 16;
+    }
+    return off + json_scan_blank_scalar(input + off, size - off);
+}
+
+__attribute__((target("avx2")))
+static size_t
+json_scan_string_avx2(const char* input, size_t size)
+{
+    const __m256i quote = _mm256_set1_epi8('\"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(' ');
+    size_t off = 0;
+
+    while(off + 32 <= size) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (input + off));
+        __m256i m = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+                                    _mm256_cmpgt_epi8(space, v));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(m);
+        if(mask != 0)
+            return off + __builtin_ctz(mask);
+        off += 32;
+    }
+    return off + json_scan_string_sse2(input + off, size - off);
+}
+
+__attribute__((target("avx2")))
+static size_t
+json_scan_blank_avx2(const char* input, size_t size)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    size_t off = 0;
+
+    while(off + 32 <= size) {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (input + off));
+        unsigned mask = (unsigned) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)));
+        if(mask != 0xffffffffu)
+            return off + __builtin_ctz(~mask);
+        off += 32;
+    }
+    return off + json_scan_blank_sse2(input + off, size - off);
+}
+#endif
+
+static size_t json_scan_string_first(const char* input, size_t size);
+static size_t json_scan_blank_first(const char* input, size_t size);
+
+static JSON_SCAN_FN json_scan_string = json_scan_string_first;
+static JSON_SCAN_FN json_scan_blank = json_scan_blank_first;
+
+static void
+json_scan_resolve(void)
+{
+#ifdef JSON_SCAN_X86
+    if(__builtin_cpu_supports("avx2")) {
+        json_scan_string = json_scan_string_avx2;
+        json_scan_blank = json_scan_blank_avx2;
+    } else {
+        json_scan_string = json_scan_string_sse2;
+        json_scan_blank = json_scan_blank_sse2;
+    }
+#else
+    json_scan_string = json_scan_string_scalar;
+    json_scan_blank = json_scan_blank_scalar;
+#endif
+}
+
+static size_t
+json_scan_string_first(const char* input, size_t size)
+{
+    json_scan_resolve();
+    return json_scan_string(input, size);
+}
+
+static size_t
+json_scan_blank_first(const char* input, size_t size)
+{
+    json_scan_resolve();
+    return json_scan_blank(input, size);
+}
+
+/* Size of the well-formed UTF-8 encoded char at `input` (see the table in
+ * json_string_automaton()), or zero if it is ill-formed or incomplete. */
+static size_t
+json_utf8_size(const char* input, size_t size)
+{
+    const unsigned char* s = (const unsigned char*) input;
+    unsigned char lo = 0x80, hi = 0xbf;
+    size_t n, i;
+
+    if(IS_IN(s[0], 0xc2, 0xdf)) {
+        n = 2;
+    } else if(s[0] == 0xe0) {
+        n = 3;
+        lo = 0xa0;
+    } else if(IS_IN(s[0], 0xe1, 0xec)  ||  IS_IN(s[0], 0xee, 0xef)) {
+        n = 3;
+    } else if(s[0] == 0xed) {
+        n = 3;
+        hi = 0x9f;
+    } else if(s[0] == 0xf0) {
+        n = 4;
+        lo = 0x90;
+    } else if(IS_IN(s[0], 0xf1, 0xf3)) {
+        n = 4;
+    } else if(s[0] == 0xf4) {
+        n = 4;
+        hi = 0x8f;
+    } else {
+        return 0;
+    }
+
+    if(size < n  ||  !IS_IN(s[1], lo, hi))
+        return 0;
+    for(i = 2; i < n; i++) {
+        if((s[i] & 0xc0) != 0x80)
+            return 0;
+    }
+    return n;
+}
+
+/* Length of the run of chars in a string which need no special care: ASCII
+ * ones (but the quotes, backslashes and control chars) and well-formed
+ * UTF-8 encoded ones (or any non-ASCII byte if ill-formed ones are ignored).
+ */
+static size_t
+json_scan_plain(const char* input, size_t size, int ignore_ill_utf8)
+{
+    size_t off = 0, n;
+
+    while(1) {
+        off += json_scan_string(input + off, size - off);
+        if(off >= size  ||  IS_ASCII(input[off]))
+            return off;
+        n = ignore_ill_utf8 ? 1 : json_utf8_size(input + off, size - off);
+        if(n == 0)
+            return off;
+        off += n;
+    }
+}
+
+
 static size_t
 json_literal_automaton(JSON_PARSER* parser, const char* input, size_t size,
                        JSON_TYPE type, const char* literal, size_t literal_size)
@@ -469,6 +685,7 @@ json_string_automaton(JSON_PARSER* parser, const char* input, size_t size,
     int fix_ill_utf8;
     size_t max_len;
     size_t off = 0;
+    size_t plain;
 
     if(type == JSON_KEY) {
         ignore_ill_utf8 = (parser->config.flags & JSON_IGNOREILLUTF8KEY);
@@ -507,15 +724,12 @@ json_string_automaton(JSON_PARSER* parser, const char* input, size_t size,
             } else if(ch == '\\') {
                 /* Start of an escape sequence. */
                 parser->substate = '\\';
-            } else if(IS_ASCII(ch)  ||  ignore_ill_utf8) {
-                /* ASCII char which needs no special care.
+            } else if((plain = json_scan_plain(input + off, size - off, ignore_ill_utf8)) > 0) {
+                /* Chars which need no special care.
                  *
-                 * This is likely the most common case. Use tight loop to
+                 * This is likely the most common case. Use the scanner to
                  * handle as many chars as possible. */
-                size_t off2 = off+1;
-                while(off2 < size  &&  IS_ASCII(input[off2])  &&  !IS_CONTROL(input[off2])
-                         &&  input[off2] != '\\'  &&  input[off2] != '\"')
-                    off2++;
+                size_t off2 = off + plain;
 
                 /* Do we have complete simple string?
                  * Then we can just process it without using temp. buffer. */
@@ -869,6 +1083,13 @@ json_feed(JSON_PARSER* parser, const char* input, size_t size)
         } else if((parser->state & CAN_SEE_VALUE)  &&  (IS_DIGIT(ch) || ch == '-')) {
             json_switch_automaton(parser, AUTOMATON_NUMBER);
             continue;
+        } else if(ch == ' '  ||  ch == '\t') {
+            /* Skip whole run of blanks (e.g. indentation) at once. */
+            size_t n = json_scan_blank(input + off, size - off);
+            off += n;
+            parser->pos.offset += n;
+            parser->pos.column_number += n;
+            continue;
         } else if(!IS_WHITESPACE(ch)) {
             json_raise_unexpected(parser);
             break;
@@ -1088,39 +1309,33 @@ json_number_to_uint64(const char* num, size_t num_size)
     return val;
 }
 
-int
-json_number_to_double(const char* num, size_t num_size, double* p_result)
+/* Powers of ten which are exactly representable as double. */
+static const double json_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define JSON_MANTISSA_MAX       ((uint64_t) 1 << 53)
+
+/* Slow but exact path: strtod() in the "C" locale.
+ *
+ * strtod() expects the string is terminated by '\0' which we do not have
+ * here, and it may expect other decimal point than '.' as specified by the
+ * current locale. We cannot afford changing the process locale to "C", even
+ * temporarily, as we could easily break multi-threaded applications; where
+ * available, we switch only the locale of the calling thread.
+ */
+static int
+json_number_strtod(const char* num, size_t num_size, double* p_result)
 {
-    struct lconv* locale_info;
     char local_buffer[64];
     char* buffer;
-
-    /* Unfortunately, AFAIK, there is no reasonably easy portable way how to
-     * construct float or double by hand.
-     *
-     * The closest to that ideal is likely strtod() function (mandated by
-     * the C89/90 standard, so hopefully, it is practically everywhere).
-     *
-     * However strtod() has (for us) two strong disadvantages we have to deal
-     * with.
-     *
-     * (1) It expects the string is terminated by '\0' which we do not have
-     *     here.
-     *
-     * (2) Instead of decimal period '.', it may expect other character as
-     *     specified by the current locale.
-     *
-     *     That is an issue on its own since, on some platforms a locale is
-     *     an attribute of thread; on other platforms it is a an attribute
-     *     of process. Some platforms even have some hybrid solution.
-     *
-     *     This means, we (as a library) cannot afford changing the locale to
-     *     "C", even temporarily, as we could easily break multi-threaded
-     *     applications.
-     *
-     * Instead, we create the new string in a temp. buffer following those
-     * requirements.
-     */
+#ifdef LC_GLOBAL_LOCALE
+    static locale_t c_locale = (locale_t) 0;
+    locale_t prev_locale;
+#else
+    struct lconv* locale_info;
+#endif
 
     if(num_size + 1 < sizeof(local_buffer)) {
         /* The number is short enough so we can avoid heap allocation. */
@@ -1135,6 +1350,21 @@ json_number_to_double(const char* num, size_t num_size, double* p_result)
     memcpy(buffer, num, num_size);
     buffer[num_size] = '\0';
 
+#ifdef LC_GLOBAL_LOCALE
+    if(c_locale == (locale_t) 0)
+        c_locale = newlocale(LC_ALL_MASK, "C", (locale_t) 0);
+    if(c_locale != (locale_t) 0) {
+        prev_locale = uselocale(c_locale);
+        *p_result = strtod(buffer, NULL);
+        uselocale(prev_locale);
+    } else {
+        /* Cannot really happen for "C"; keep the result sane anyway. */
+        char* fp = strchr(buffer, '.');
+        if(fp != NULL)
+            *fp = localeconv()->decimal_point[0];
+        *p_result = strtod(buffer, NULL);
+    }
+#else
     /* Make sure we use the locale-dependent decimal point. */
     locale_info = localeconv();
     if(locale_info->decimal_point[0] != '.') {
@@ -1146,12 +1376,142 @@ json_number_to_double(const char* num, size_t num_size, double* p_result)
     }
 
     *p_result = strtod(buffer, NULL);
+#endif
 
     if(buffer != local_buffer)
         free(buffer);
     return 0;
 }
 
+int
+json_number_decode(const char* num, size_t num_size,
+                   int* p_is_int64, int64_t* p_i64, double* p_dbl)
+{
+    size_t off = 0;
+    int is_neg = 0;
+    int is_int = 1;
+    int truncated = 0;
+    int n_digits = 0;
+    int exp10 = 0;
+    uint64_t mant = 0;
+    double d;
+
+    /* Single pass over the string. At most 19 significant digits are
+     * accumulated in the mantissa (so it can never overflow), the position
+     * of the decimal point and the exponent go to exp10. */
+    if(off < num_size  &&  num[off] == '-') {
+        is_neg = 1;
+        off++;
+    }
+
+    while(off < num_size  &&  IS_DIGIT(num[off])) {
+        if(n_digits < 19) {
+            mant = mant * 10 + (num[off] - '0');
+            if(mant != 0)
+                n_digits++;
+        } else {
+            if(num[off] != '0')
+                truncated = 1;
+            exp10++;
+        }
+        off++;
+    }
+
+    if(off < num_size  &&  num[off] == '.') {
+        is_int = 0;
+        off++;
+        while(off < num_size  &&  IS_DIGIT(num[off])) {
+            if(n_digits < 19) {
+                mant = mant * 10 + (num[off] - '0');
+                if(mant != 0)
+                    n_digits++;
+                exp10--;
+            } else if(num[off] != '0') {
+                truncated = 1;
+            }
+            off++;
+        }
+    }
+
+    if(off < num_size  &&  (num[off] == 'e'  ||  num[off] == 'E')) {
+        int exp_neg = 0;
+        int exp_val = 0;
+
+        is_int = 0;
+        off++;
+        if(off < num_size  &&  (num[off] == '+'  ||  num[off] == '-')) {
+            exp_neg = (num[off] == '-');
+            off++;
+        }
+        while(off < num_size  &&  IS_DIGIT(num[off])) {
+            /* Anything this big is zero or infinity anyway. */
+            if(exp_val < 100000)
+                exp_val = exp_val * 10 + (num[off] - '0');
+            off++;
+        }
+        exp10 += (exp_neg ? -exp_val : exp_val);
+    }
+
+    /* Integer? (The same rules as json_analyze_number().) */
+    if(is_int  &&  exp10 == 0  &&
+       mant <= (is_neg ? (uint64_t) INT64_MAX + 1 : (uint64_t) INT64_MAX))
+    {
+        *p_is_int64 = 1;
+        /* Trick to avoid underflow issues if the correct result is INT64_MIN. */
+        *p_i64 = (is_neg && mant != 0) ? -(int64_t)(mant - 1) - 1 : (int64_t) mant;
+        return 0;
+    }
+
+    *p_is_int64 = 0;
+
+    if(mant == 0  &&  !truncated) {
+        *p_dbl = (is_neg ? -0.0 : 0.0);
+        return 0;
+    }
+
+    /* Fast path (Clinger): when both the mantissa and the power of ten are
+     * exact doubles, a single IEEE multiplication or division is correctly
+     * rounded. Exponents slightly above 22 still qualify if the excess can
+     * be moved into the mantissa without leaving the exact range.
+     *
+     * This needs the operations to be evaluated in double precision, not
+     * in some wider x87 format. */
+#if defined FLT_EVAL_METHOD  &&  FLT_EVAL_METHOD == 0
+    if(!truncated  &&  mant <= JSON_MANTISSA_MAX) {
+        if(exp10 > 22  &&  exp10 <= 22 + 15) {
+            while(exp10 > 22  &&  mant <= JSON_MANTISSA_MAX / 10) {
+                mant *= 10;
+                exp10--;
+            }
+        }
+
+        if(exp10 >= -22  &&  exp10 <= 22) {
+            d = (double) mant;
+            if(exp10 < 0)
+                d /= json_pow10[-exp10];
+            else
+                d *= json_pow10[exp10];
+            *p_dbl = (is_neg ? -d : d);
+            return 0;
+        }
+    }
+#endif
+
+    return json_number_strtod(num, num_size, p_dbl);
+}
+
+int
+json_number_to_double(const char* num, size_t num_size, double* p_result)
+{
+    int is_int64;
+    int64_t i64;
+    int ret;
+
+    ret = json_number_decode(num, num_size, &is_int64, &i64, p_result);
+    if(ret == 0  &&  is_int64)
+        *p_result = (double) i64;
+    return ret;
+}
 
 int
 json_dump_int32(int32_t i32, JSON_DUMP_CALLBACK write_func, void* user_data)
@@ -1165,131 +1525,400 @@ json_dump_uint32(uint32_t u32, JSON_DUMP_CALLBACK write_func, void* user_data)
     return json_dump_uint64(u32, write_func, user_data);
 }
 
-int
-json_dump_int64(int64_t i64, JSON_DUMP_CALLBACK write_func, void* user_data)
+/* "00" "01" ... "99": integers are formatted two digits at a time. */
+static const char json_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint64_t json_pow10_u64[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+    10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+    100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static unsigned
+json_count_digits(uint64_t u64)
 {
-    char buffer[32];
-    size_t off = sizeof(buffer);
-    int is_neg = (i64 < 0);
-
-    if(i64 != 0) {
-        while(i64 != 0) {
-            buffer[--off] = '0' + ABS(i64 % 10);
-            i64 /= 10;
-        }
+    unsigned n = 1;
+
+    while(n < 20  &&  u64 >= json_pow10_u64[n])
+        n++;
+    return n;
+}
 
-        if(is_neg)
-            buffer[--off] = '-';
+size_t
+json_format_uint64(uint64_t u64, char* buffer)
+{
+    unsigned n = json_count_digits(u64);
+    char* ptr = buffer + n;
+
+    *ptr = '\0';
+    while(u64 >= 100) {
+        unsigned i = (unsigned)(u64 % 100) * 2;
+        u64 /= 100;
+        *--ptr = json_digit_pairs[i + 1];
+        *--ptr = json_digit_pairs[i];
+    }
+    if(u64 >= 10) {
+        *--ptr = json_digit_pairs[u64 * 2 + 1];
+        *--ptr = json_digit_pairs[u64 * 2];
     } else {
-        buffer[--off] = '0';
+        *--ptr = (char)('0' + u64);
     }
 
-    return write_func(buffer + off, sizeof(buffer) - off, user_data);
+    return n;
 }
 
-int
-json_dump_uint64(uint64_t u64, JSON_DUMP_CALLBACK write_func, void* user_data)
+size_t
+json_format_int64(int64_t i64, char* buffer)
 {
-    char buffer[32];
-    size_t off = sizeof(buffer);
+    if(i64 < 0) {
+        buffer[0] = '-';
+        /* Trick to avoid overflow issues if the value is INT64_MIN. */
+        return 1 + json_format_uint64((uint64_t)(-(i64 + 1)) + 1, buffer + 1);
+    }
 
-    if(u64 != 0) {
-        while(u64 != 0) {
-            buffer[--off] = '0' + (u64 % 10);
-            u64 /= 10;
-        }
-    } else {
-        buffer[--off] = '0';
+    return json_format_uint64((uint64_t) i64, buffer);
+}
+
+
+/* Shortest representation of a double which reads back to the same value,
+ * using the Grisu2 algorithm (Florian Loitsch, "Printing Floating-Point
+ * Numbers Quickly and Accurately with Integers", 2010).
+ *
+ * The number is held as f * 2^e with a 64-bit f ("do-it-yourself floating
+ * point"), scaled by a cached power of ten so that the digits can be
+ * generated with integer arithmetic only.
+ */
+typedef struct JSON_DIYFP_tag JSON_DIYFP;
+struct JSON_DIYFP_tag {
+    uint64_t f;
+    int e;
+};
+
+#define JSON_DP_SIGNIFICAND_MASK    0x000FFFFFFFFFFFFFULL
+#define JSON_DP_EXPONENT_MASK       0x7FF0000000000000ULL
+#define JSON_DP_HIDDEN_BIT          0x0010000000000000ULL
+#define JSON_DP_EXPONENT_BIAS       (0x3FF + 52)
+
+/* Normalized 10^-348, 10^-340, ..., 10^340. */
+static const uint64_t json_cached_powers_f[] = {
+    0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+    0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+    0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+    0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+    0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+    0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+    0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+    0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+    0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+    0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+    0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+    0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+    0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+    0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+    0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+    0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+    0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+    0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+    0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+    0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+    0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+    0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+    0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+    0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+    0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+    0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+    0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+    0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+    0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t json_cached_powers_e[] = {
+    -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+    -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+    -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+    -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+    -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+    109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+    375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+    641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+    907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static JSON_DIYFP
+json_diyfp_mul(JSON_DIYFP a, JSON_DIYFP b)
+{
+    JSON_DIYFP r;
+#if defined __SIZEOF_INT128__
+    unsigned __int128 p = (unsigned __int128) a.f * b.f;
+    uint64_t h = (uint64_t)(p >> 64);
+    uint64_t l = (uint64_t) p;
+
+    if(l & (1ULL << 63))    /* Round. */
+        h++;
+    r.f = h;
+#else
+    const uint64_t M32 = 0xFFFFFFFFULL;
+    const uint64_t a_hi = a.f >> 32;
+    const uint64_t a_lo = a.f & M32;
+    const uint64_t b_hi = b.f >> 32;
+    const uint64_t b_lo = b.f & M32;
+    const uint64_t hh = a_hi * b_hi;
+    const uint64_t hl = a_hi * b_lo;
+    const uint64_t lh = a_lo * b_hi;
+    const uint64_t ll = a_lo * b_lo;
+    uint64_t tmp = (ll >> 32) + (hl & M32) + (lh & M32);
+
+    tmp += 1ULL << 31;      /* Round. */
+    r.f = hh + (hl >> 32) + (lh >> 32) + (tmp >> 32);
+#endif
+    r.e = a.e + b.e + 64;
+    return r;
+}
+
+static JSON_DIYFP
+json_diyfp_normalize(JSON_DIYFP x)
+{
+    while(!(x.f & (1ULL << 63))) {
+        x.f <<= 1;
+        x.e--;
     }
+    return x;
+}
 
-    return write_func(buffer + off, sizeof(buffer) - off, user_data);
+static void
+json_grisu_round(char* buffer, size_t len, uint64_t delta, uint64_t rest,
+                 uint64_t ten_kappa, uint64_t wp_w)
+{
+    while(rest < wp_w  &&  delta - rest >= ten_kappa  &&
+          (rest + ten_kappa < wp_w  ||  wp_w - rest > rest + ten_kappa - wp_w))
+    {
+        buffer[len - 1]--;
+        rest += ten_kappa;
+    }
 }
 
-int
-json_dump_double(double dbl, JSON_DUMP_CALLBACK write_func, void* user_data)
+static void
+json_grisu_digits(JSON_DIYFP w, JSON_DIYFP mp, uint64_t delta,
+                  char* buffer, size_t* p_len, int* p_k)
 {
-    static const char fmt[] = "%.16lg";
-    static const size_t extra_bytes = 2;    /* Space reserved for ".0" */
-    struct lconv* locale_info;
-    int n;
-    char local_buffer[64];
-    size_t capacity = sizeof(local_buffer) - extra_bytes;
-    char* buffer = local_buffer;
-    char* new_buffer;
-    char* fp;
-    int ret;
+    const int shift = -mp.e;
+    const uint64_t one = 1ULL << shift;
+    const uint64_t wp_w = mp.f - w.f;
+    uint32_t p1 = (uint32_t)(mp.f >> shift);
+    uint64_t p2 = mp.f & (one - 1);
+    int kappa = (int) json_count_digits(p1);
+    size_t len = 0;
+
+    /* Integral part. */
+    while(kappa > 0) {
+        uint32_t div = (uint32_t) json_pow10_u64[kappa - 1];
+        uint32_t d = p1 / div;
+        uint64_t rest;
+
+        p1 %= div;
+        if(d != 0  ||  len > 0)
+            buffer[len++] = (char)('0' + d);
+        kappa--;
+
+        rest = ((uint64_t) p1 << shift) + p2;
+        if(rest <= delta) {
+            *p_k += kappa;
+            json_grisu_round(buffer, len, delta, rest,
+                             json_pow10_u64[kappa] << shift, wp_w);
+            *p_len = len;
+            return;
+        }
+    }
 
+    /* Fractional part. */
     while(1) {
-        n = snprintf(buffer, capacity, fmt, dbl);
-        if(n >= 0  &&  (size_t)n < capacity)
-            break;
+        char d;
+
+        p2 *= 10;
+        delta *= 10;
+        d = (char)(p2 >> shift);
+        if(d != 0  ||  len > 0)
+            buffer[len++] = (char)('0' + d);
+        p2 &= one - 1;
+        kappa--;
+
+        if(p2 < delta) {
+            *p_k += kappa;
+            json_grisu_round(buffer, len, delta, p2, one,
+                             (-kappa < 20) ? wp_w * json_pow10_u64[-kappa] : 0);
+            *p_len = len;
+            return;
+        }
+    }
+}
 
-        /* If the buffer is insufficient, old snprintf() implementations
-         * only report the buffer is too small and don't tell how large
-         * the buffer has to be. So lets grow the buffer until it is large
-         * enough. */
-        if(n < 0)
-            capacity *= 2;
-        else
-            capacity = n + 1;
+/* Writes the significant digits of a finite positive double into buffer,
+ * and the decimal exponent into *p_k, so that dbl == digits * 10^k. */
+static size_t
+json_grisu2(double dbl, char* buffer, int* p_k)
+{
+    JSON_DIYFP v, w, plus, minus, c_mk;
+    uint64_t bits;
+    double dk;
+    int k;
+    unsigned index;
+    size_t len;
+
+    memcpy(&bits, &dbl, sizeof(bits));
+    v.f = bits & JSON_DP_SIGNIFICAND_MASK;
+    if(bits & JSON_DP_EXPONENT_MASK) {
+        v.f += JSON_DP_HIDDEN_BIT;
+        v.e = (int)((bits & JSON_DP_EXPONENT_MASK) >> 52) - JSON_DP_EXPONENT_BIAS;
+    } else {
+        v.e = 1 - JSON_DP_EXPONENT_BIAS;
+    }
 
-        /* Make the terrain safe for realloc(). */
-        if(buffer == local_buffer)
-            buffer = NULL;
+    /* Boundaries m+ and m- halfway to the neighbouring doubles, sharing
+     * the exponent of the normalized m+. */
+    plus.f = (v.f << 1) + 1;
+    plus.e = v.e - 1;
+    while(!(plus.f & (JSON_DP_HIDDEN_BIT << 1))) {
+        plus.f <<= 1;
+        plus.e--;
+    }
+    plus.f <<= 64 - 54;
+    plus.e -= 64 - 54;
 
-        new_buffer = (char *) realloc(buffer, capacity + extra_bytes);
-        if(new_buffer == NULL) {
-            free(buffer);
-            return JSON_ERR_OUTOFMEMORY;
-        }
-        buffer = new_buffer;
+    if(v.f == JSON_DP_HIDDEN_BIT) {
+        minus.f = (v.f << 2) - 1;
+        minus.e = v.e - 2;
+    } else {
+        minus.f = (v.f << 1) - 1;
+        minus.e = v.e - 1;
     }
+    minus.f <<= minus.e - plus.e;
+    minus.e = plus.e;
+
+    /* Cached power c_mk = 10^-k bringing the exponent into [-60, -32]. */
+    dk = (-61 - plus.e) * 0.30102999566398114 + 347;
+    k = (int) dk;
+    if(dk - k > 0.0)
+        k++;
+    index = (unsigned)((k >> 3) + 1);
+    c_mk.f = json_cached_powers_f[index];
+    c_mk.e = json_cached_powers_e[index];
+    *p_k = -(-348 + (int) index * 8);
+
+    w = json_diyfp_mul(json_diyfp_normalize(v), c_mk);
+    plus = json_diyfp_mul(plus, c_mk);
+    minus = json_diyfp_mul(minus, c_mk);
+    minus.f++;
+    plus.f--;
+
+    json_grisu_digits(w, plus, plus.f - minus.f, buffer, &len, p_k);
+    return len;
+}
 
-    /* Similar pain as above for strtod(). We need to fight with snprintf() and
-     * undo the locale-dependent stuff. */
-    locale_info = localeconv();
+size_t
+json_format_double(double dbl, char* buffer)
+{
+    char digits[32];
+    size_t len;
+    int k;
+    int point;
+    char* ptr = buffer;
+    uint64_t bits;
+
+    memcpy(&bits, &dbl, sizeof(bits));
+
+    /* JSON has no infinity nor NaN. */
+    if((bits & JSON_DP_EXPONENT_MASK) == JSON_DP_EXPONENT_MASK) {
+        memcpy(buffer, "null", 5);
+        return 4;
+    }
 
-    /* Remove all potential locale-provided thousand separators. */
-    if(locale_info->thousands_sep != NULL  &&  locale_info->thousands_sep[0]) {
-        char* sep = locale_info->thousands_sep;
-        size_t sep_len = strlen(sep);
-        char* ptr = buffer;
+    if(bits >> 63) {
+        *ptr++ = '-';
+        dbl = -dbl;
+    }
 
-        while(1) {
-            ptr = strstr(ptr, sep);
-            if(ptr == NULL)
-                break;
+    if(dbl == 0.0) {
+        memcpy(ptr, "0.0", 4);
+        return (size_t)(ptr - buffer) + 3;
+    }
 
-            memmove(ptr, ptr + sep_len, n - (ptr - buffer));
-            n -= sep_len;
+    len = json_grisu2(dbl, digits, &k);
+    point = (int) len + k;      /* Position of the decimal point. */
+
+    /* Choose between the plain and the scientific notation the same way as
+     * printf("%.16g") does, but with the shortest digits. In both cases
+     * the result always reads back as a double: the plain notation always
+     * gets a decimal point. */
+    if(point > -4  &&  point <= 16) {
+        if(point <= 0) {
+            memcpy(ptr, "0.", 2);
+            ptr += 2;
+            memset(ptr, '0', (size_t) -point);
+            ptr += -point;
+            memcpy(ptr, digits, len);
+            ptr += len;
+        } else if((size_t) point < len) {
+            memcpy(ptr, digits, (size_t) point);
+            ptr += point;
+            *ptr++ = '.';
+            memcpy(ptr, digits + point, len - (size_t) point);
+            ptr += len - (size_t) point;
+        } else {
+            memcpy(ptr, digits, len);
+            ptr += len;
+            memset(ptr, '0', (size_t) point - len);
+            ptr += (size_t) point - len;
+            memcpy(ptr, ".0", 2);
+            ptr += 2;
         }
-    }
+    } else {
+        int exp10 = point - 1;
 
-    /* Replace the locale-provided decimal point with '.'. */
-    fp = strchr(buffer, locale_info->decimal_point[0]);
-    if(fp != NULL) {
-        *fp = '.';
-    } else if(strchr(buffer, 'e') == NULL) {
-        /* There is no decimal point present and also no 'e', i.e. it's not
-         * in the scientific notation, i.e. it looks too much as an integer
-         * if we ever re-read the value back.
-         *
-         * For the sake of consistency, let's make sure that, if we ever
-         * re-read the string again, we shall map it to double again, by
-         * appending the decimal point.
-         *
-         * We may do this safely: We reserved few bytes in the buffer exactly
-         * for this purpose.
-         */
-        memcpy(buffer + n, ".0", 2);
-        n += 2;
+        *ptr++ = digits[0];
+        if(len > 1) {
+            *ptr++ = '.';
+            memcpy(ptr, digits + 1, len - 1);
+            ptr += len - 1;
+        }
+        *ptr++ = 'e';
+        *ptr++ = (exp10 < 0) ? '-' : '+';
+        ptr += json_format_uint64((uint64_t) ABS(exp10), ptr);
     }
 
-    ret = write_func(buffer, n, user_data);
+    *ptr = '\0';
+    return (size_t)(ptr - buffer);
+}
 
-    if(buffer != local_buffer)
-        free(buffer);
-    return ret;
+int
+json_dump_int64(int64_t i64, JSON_DUMP_CALLBACK write_func, void* user_data)
+{
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    size_t n = json_format_int64(i64, buffer);
+
+    return write_func(buffer, n, user_data);
+}
+
+int
+json_dump_uint64(uint64_t u64, JSON_DUMP_CALLBACK write_func, void* user_data)
+{
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    size_t n = json_format_uint64(u64, buffer);
+
+    return write_func(buffer, n, user_data);
+}
+
+int
+json_dump_double(double dbl, JSON_DUMP_CALLBACK write_func, void* user_data)
+{
+    char buffer[JSON_NUMBER_BUFFER_SIZE];
+    size_t n = json_format_double(dbl, buffer);
+
+    return write_func(buffer, n, user_data);
 }
 
 static void
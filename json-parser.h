@@ -273,6 +273,36 @@ int64_t json_number_to_int64(const char* num, size_t num_size);
 uint64_t json_number_to_uint64(const char* num, size_t num_size);
 int json_number_to_double(const char* num, size_t num_size, double* p_result);
 
+/* Classify and convert the string holding JSON number in a single pass,
+ * independently of the current locale.
+ *
+ * If the number has no fraction nor exponent part and fits into int64_t,
+ * *p_is_int64 is set to non-zero and the value is stored into *p_i64.
+ * Otherwise *p_is_int64 is set to zero and *p_dbl gets the nearest double.
+ *
+ * Returns zero on success, or JSON_ERR_OUTOFMEMORY.
+ */
+int json_number_decode(const char* num, size_t num_size,
+                       int* p_is_int64, int64_t* p_i64, double* p_dbl);
+
+
+/* Format numbers into a caller-provided buffer of (at least)
+ * JSON_NUMBER_BUFFER_SIZE bytes. No allocation and no locale is involved.
+ *
+ * json_format_double() writes the shortest representation which reads back
+ * as the same double. It always contains a decimal point or an exponent, so
+ * it is never mistaken for an integer. Infinities and NaN, which JSON cannot
+ * represent, are written as null.
+ *
+ * The result is zero-terminated; the returned length does not include the
+ * terminator.
+ */
+#define JSON_NUMBER_BUFFER_SIZE     32
+
+size_t json_format_int64(int64_t i64, char* buffer);
+size_t json_format_uint64(uint64_t u64, char* buffer);
+size_t json_format_double(double dbl, char* buffer);
+
 
 typedef int (*JSON_DUMP_CALLBACK)(const char* /*str*/, size_t /*size*/, void* /*user_data*/);
 
@@ -27,6 +27,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <ctype.h>
 
@@ -51,43 +53,90 @@
 
 	so these actually just returns longs, offsets into
 	the shared memory where the object is
+
+	The nodes (values and items) have fixed sizes, so
+	they are allocated from slabs (`shslab_alloc`)
 */
 
 /*
-	Very basic "dict" implementation
-	(it's to be used in shell commands, so speed
-	can be, a little bit, discarded)
+	Dicts are hash tables that keep the insertion order
+
+	The items are appended to `entries`, and the index (open
+	addressing, with twice the slots) has their positions there.
+	Deleted items stay in `entries`, with no key, until the table
+	is rebuilt (when it's full).
+
+	Keys are interned (see `struct j_key`), so these are compared
+	by their offset.
 */
-struct j_dict_item {
-	long ptr_next_item;
-	long str_key;
+struct j_dict_entry {
+	long key;	// -1 if deleted
 	long ptr_value;
 };
 
+struct j_dict_table {
+	int refs;	// dicts sharing it (see `j_copy`)
+	int cap;	// entries, the index has `cap*2` slots
+	int used;	// entries used, deleted ones included
+	struct j_dict_entry entries[];
+	// followed by the index, -1 on empty slots
+};
+
+#define J_DICT_MIN	4
+#define J_DICT_INDEX(t)	((int*)((t)->entries + (t)->cap))
+#define J_DICT_SIZE(cap)	(sizeof(struct j_dict_table) + (cap) * (sizeof(struct j_dict_entry) + 2 * sizeof(int)))
+
 /*
-	Linked list
+	Lists are ring buffers with the offsets of the values, so
+	these are indexed, and grow or shrink at both ends, in O(1)
 */
-struct j_list_item {
-	long ptr_next_item;
-	long ptr_value;
+struct j_list_buf {
+	int refs;	// lists sharing it (see `j_copy`)
+	int cap;	// a power of 2
+	int head;	// position of the first value
+	long values[];
 };
 
+#define J_LIST_MIN	4
+#define J_LIST_AT(b, i)	((b)->values[((b)->head + (i)) & ((b)->cap - 1)])
+#define J_LIST_SIZE(cap)	(sizeof(struct j_list_buf) + (cap) * sizeof(long))
+
+// longest string kept in the value itself (and its length byte)
+#define J_STR_INLINE	22
+
+// values referenced this many times are never freed (but by `j_compact`)
+#define J_REFS_MAX	0xffff
+
 struct j_value {
-	int jtype;
+	unsigned char jtype;
+	unsigned char flags;
+	// references to it (see `j_ref`), not used in arenas
+	unsigned short refs;
+	// slot (+1) of its handler (see `j_handle`), 0 if it has none
+	int handle;
 	union {
 		struct {
-			long ptr_dict_head;
-			long ptr_dict_tail;
+			long ptr_dict_table;	// -1 if never set
 			int dict_len;
+			unsigned long dict_hash;	// sum of the entries (see `j_hash`)
 		};
 		struct {
-			long ptr_list_head;
-			long ptr_list_tail;
+			long ptr_list_buf;	// -1 if never set
 			int list_len;
+			unsigned long list_hash;	// sum of the values (see `j_hash`)
 		};
 		long val_integer;
 		double val_float;
-		long str_val;
+		struct {
+			long str_val;
+			int str_len;
+			unsigned long str_hash;	// 0 until needed
+		};
+		// short strings are kept here (see `JFLAG_INLINE`)
+		struct {
+			char str_inline[J_STR_INLINE+1];
+			unsigned char str_inline_len;
+		};
 	};
 };
 
@@ -110,46 +159,449 @@ struct j_value {
 	- hasval (dict, list)
 */
 
+#define JFLAG_ARENA	1
+#define JFLAG_INLINE	2	// string in `str_inline`
+#define JFLAG_OWNER	4	// dict/list whose shared table has its own values (see `j_copy`)
+#define JFLAG_LENT	8	// dict/list whose values may change without it knowing (see `j_hash`)
+
+// what is kept in the shared memory roots (`shmem_roots`)
+#define J_ROOT_HANDLES	0
+#define J_ROOT_KEYS	1
+
 /*
-	NEW functions
+	Immediates
+
+	null, booleans and integers (that fit in 62 bits) are not allocated,
+	these are encoded in the offset itself. Offsets of values are always
+	a multiple of 8, and never negative (that's an error):
+	- integers are `zigzag << 1 | 1`
+	- null, false and true are 2, 4 and 6
+*/
+#define J_NULL	2L
+#define J_FALSE	4L
+#define J_TRUE	6L
+#define J_IMMEDIATE(obj)	((obj) & 7)
+#define J_INT_MIN	(-(1L << 61))
+#define J_INT_MAX	((1L << 61) - 1)
+
+static long _j_int_encode(long val)
+{
+	unsigned long zigzag = ((unsigned long)val << 1) ^ (unsigned long)(val >> 63);
+	return (long)(zigzag << 1 | 1);
+}
+
+static long _j_int_decode(long obj)
+{
+	unsigned long zigzag = (unsigned long)obj >> 1;
+	return (long)(zigzag >> 1) ^ -(long)(zigzag & 1);
+}
+
+
+/*
+	Keys
+
+	Dict keys are interned, there's one atom per distinct key in the
+	whole shared memory, in a table (`J_ROOT_KEYS`), and dicts keep
+	just its offset. Atoms are counted, once per entry of the dicts,
+	and once per arena for all of its dicts (so these don't walk the
+	entries when released), and go away when no longer used.
 */
+struct j_key {
+	long refs;
+	unsigned long hash;
+	int len;
+	char str[];	// NULL terminated too
+};
+
+// set of atoms, open addressing, at most half full
+struct j_keys {
+	long len;
+	long cap;	// a power of 2
+	long slots[];	// -1 if empty
+};
+
+#define J_KEYS_MIN	64
+#define J_KEY(shm, key)	((struct j_key*)shpointer(shm, key))
+
+static void _j_keys_put(void *shm, struct j_keys *set, long key)
+{
+	unsigned long mask = set->cap - 1;
+	unsigned long i;
+	for(i = J_KEY(shm, key)->hash & mask; set->slots[i] >= 0; i = (i+1) & mask);
+	set->slots[i] = key;
+	set->len++;
+}
 
-// use these to store a single NULL, TRUE or FALSE
-long ptr_j_null = -1;
-long ptr_j_true = -1;
-long ptr_j_false = -1;
+// move the set to a new one with `cap` slots, returns it, -1 on failure
+static long _j_keys_resize(void *shm, long set, long cap)
+{
+	long off = shmalloc(shm, sizeof(struct j_keys) + cap * sizeof(long));
+	if(off < 0)
+		return -1;
+	struct j_keys *nks = shpointer(shm, off);
+	nks->len = 0;
+	nks->cap = cap;
+	memset(nks->slots, 0xff, cap * sizeof(long));
+	if(set >= 0)
+	{
+		// after malloc, re-get pointers
+		struct j_keys *ks = shpointer(shm, set);
+		for(long i = 0; i < ks->cap; i++)
+			if(ks->slots[i] >= 0)
+				_j_keys_put(shm, nks, ks->slots[i]);
+		shfree(shm, set);
+	}
+	return off;
+}
+
+// add the atom to the set (at `set`), returns the set (it may move), -1 on failure
+static long _j_keys_add(void *shm, long set, long key)
+{
+	struct j_keys *ks = set < 0 ? NULL : shpointer(shm, set);
+	if(!ks || (ks->len+1) * 2 > ks->cap)
+	{
+		if((set = _j_keys_resize(shm, set, ks ? ks->cap << 1 : J_KEYS_MIN)) < 0)
+			return -1;
+		ks = shpointer(shm, set);
+	}
+	_j_keys_put(shm, ks, key);
+	return set;
+}
+
+// the slot of the atom in the set, -1 if not there
+static long _j_keys_slot(void *shm, struct j_keys *set, long key)
+{
+	unsigned long mask = set->cap - 1;
+	for(unsigned long i = J_KEY(shm, key)->hash & mask; set->slots[i] >= 0; i = (i+1) & mask)
+		if(set->slots[i] == key)
+			return i;
+	return -1;
+}
+
+// the atom of `key`, -1 if there's none (no dict has it)
+static long _j_key_find(void *shm, char *key, int key_len, unsigned long hash)
+{
+	long table = shmem_roots(shm)[J_ROOT_KEYS];
+	if(table < 0)
+		return -1;
+	struct j_keys *ks = shpointer(shm, table);
+	unsigned long mask = ks->cap - 1;
+	for(unsigned long i = hash & mask; ks->slots[i] >= 0; i = (i+1) & mask)
+	{
+		struct j_key *k = J_KEY(shm, ks->slots[i]);
+		if(k->hash == hash && k->len == key_len && !memcmp(k->str, key, key_len))
+			return ks->slots[i];
+	}
+	return -1;
+}
+
+// the atom of `key`, with a reference for the caller, -1 on failure
+static long _j_key_intern(void *shm, char *key, int key_len, unsigned long hash)
+{
+	long atom = _j_key_find(shm, key, key_len, hash);
+	if(atom >= 0)
+	{
+		J_KEY(shm, atom)->refs++;
+		return atom;
+	}
+	atom = shmalloc(shm, sizeof(struct j_key) + key_len + 1);
+	if(atom < 0)
+		return -1;
+	struct j_key *k = J_KEY(shm, atom);
+	k->refs = 1;
+	k->hash = hash;
+	k->len = key_len;
+	memcpy(k->str, key, key_len);
+	k->str[key_len] = 0;
+	long table = _j_keys_add(shm, shmem_roots(shm)[J_ROOT_KEYS], atom);
+	if(table < 0)
+	{
+		shfree(shm, atom);
+		return -1;
+	}
+	shmem_roots(shm)[J_ROOT_KEYS] = table;
+	return atom;
+}
+
+static void _j_key_release(void *shm, long atom)
+{
+	if(--J_KEY(shm, atom)->refs > 0)
+		return;
+	// out of the table, the ones after it move back (if they can)
+	struct j_keys *ks = shpointer(shm, shmem_roots(shm)[J_ROOT_KEYS]);
+	unsigned long mask = ks->cap - 1;
+	unsigned long i = _j_keys_slot(shm, ks, atom), j;
+	for(j = (i+1) & mask; ks->slots[j] >= 0; j = (j+1) & mask)
+	{
+		unsigned long home = J_KEY(shm, ks->slots[j])->hash & mask;
+		if(((j - home) & mask) >= ((j - i) & mask))
+		{
+			ks->slots[i] = ks->slots[j];
+			i = j;
+		}
+	}
+	ks->slots[i] = -1;
+	ks->len--;
+	shfree(shm, atom);
+	long *table = shmem_roots(shm) + J_ROOT_KEYS;
+	if(!ks->len)
+	{
+		shfree(shm, *table);
+		*table = -1;
+	}
+	else if(ks->cap > J_KEYS_MIN && ks->len * 8 < ks->cap)
+	{
+		// mostly empty, give some back (it's fine if it can't)
+		long smaller = _j_keys_resize(shm, *table, ks->cap >> 1);
+		if(smaller >= 0)
+			shmem_roots(shm)[J_ROOT_KEYS] = smaller;
+	}
+}
+
+/*
+	Arenas
+
+	A document can be loaded into an arena (see `j_parse_file`), all its
+	nodes are bump allocated there and are not freed one by one, the
+	arena is counted as a whole: references to any of its nodes, from
+	outside of it (handlers, other containers, callers), and it's all
+	released with the last one. Links between its nodes are not counted.
+
+	Values from outside set later into arena containers (`j_list_set`,
+	`j_dict_set`) are kept in `foreign`, with their references, until
+	these are taken out again or the arena goes away.
+*/
+struct j_arena {
+	long refs;
+	// values linked from its nodes (`struct j_links`), -1 if none
+	long foreign;
+	// atoms of the keys of its dicts (`struct j_keys`), -1 if none
+	long keys;
+};
+
+// values with a reference each, may repeat
+struct j_links {
+	long len;
+	long cap;
+	long values[];
+};
+
+// arena for new values, while parsing into one
+static long _j_arena = -1;
+
+#define J_IN_ARENA(jv)	((jv)->flags & JFLAG_ARENA)
+#define J_COLLECTION(jv)	((jv)->jtype == JTYPE_DICT || (jv)->jtype == JTYPE_LIST)
+
+static struct j_arena *_j_arena_of(void *shm, long obj)
+{
+	return shpointer(shm, sharena_of(shm, obj));
+}
+
+// add a value to the (arena's) list at `*links`
+static int _j_links_add(void *shm, long *links, long value)
+{
+	struct j_links *l = *links < 0 ? NULL : shpointer(shm, *links);
+	if(!l || l->len == l->cap)
+	{
+		long cap = l ? l->cap << 1 : 8;
+		long off = shmalloc(shm, sizeof(struct j_links) + cap * sizeof(long));
+		if(off < 0)
+			return -1;
+		// after malloc, re-get pointers
+		struct j_links *nl = shpointer(shm, off);
+		nl->len = 0;
+		nl->cap = cap;
+		if(*links >= 0)
+		{
+			l = shpointer(shm, *links);
+			memcpy(nl->values, l->values, l->len * sizeof(long));
+			nl->len = l->len;
+			shfree(shm, *links);
+		}
+		*links = off;
+		l = nl;
+	}
+	l->values[l->len++] = value;
+	return 0;
+}
+
+// take (one of) the value out of the list, the latest is the likeliest
+static void _j_links_del(void *shm, long *links, long value)
+{
+	struct j_links *l = shpointer(shm, *links);
+	for(long i = l->len - 1; i >= 0; i--)
+		if(l->values[i] == value)
+		{
+			l->values[i] = l->values[--l->len];
+			break;
+		}
+	if(!l->len)
+	{
+		shfree(shm, *links);
+		*links = -1;
+	}
+}
 
-static long _j_base_new(void *shm, long *store, int type)
+static long _j_value_new(void *shm, int type)
 {
-	PD("_j_base_new");
-	if(*store >= 0)
-		return *store;
-	long ptr = shmalloc(shm, sizeof(struct j_value));
-	if(ptr<0)
-		return ptr;
-	struct j_value *jv = shpointer(shm, ptr);
+	long j_off;
+	if(_j_arena >= 0)
+		j_off = sharena_alloc(shm, _j_arena, sizeof(struct j_value));
+	else
+		j_off = shslab_alloc(shm, sizeof(struct j_value));
+	if(j_off < 0)
+		return -1;
+	struct j_value *jv = shpointer(shm, j_off);
 	jv->jtype = type;
-	return *store = ptr;
+	jv->flags = _j_arena >= 0 ? JFLAG_ARENA : 0;
+	jv->refs = 1;
+	jv->handle = 0;
+	if(_j_arena >= 0)
+		((struct j_arena*)shpointer(shm, _j_arena))->refs++;
+	return j_off;
+}
+
+// start placing new values in a new arena
+static int _j_arena_begin(void *shm)
+{
+	_j_arena = sharena_new(shm, sizeof(struct j_arena));
+	if(_j_arena < 0)
+		return -1;
+	struct j_arena *meta = shpointer(shm, _j_arena);
+	// one for while it's being filled
+	meta->refs = 1;
+	meta->foreign = -1;
+	meta->keys = -1;
+	return 0;
+}
+
+static void _j_arena_free(void *shm, long arena)
+{
+	struct j_arena *meta = shpointer(shm, arena);
+	if(meta->foreign >= 0)
+	{
+		struct j_links *l = shpointer(shm, meta->foreign);
+		for(long i = 0; i < l->len; i++)
+			j_free(shm, l->values[i]);
+		// (may have moved)
+		shfree(shm, ((struct j_arena*)shpointer(shm, arena))->foreign);
+	}
+	// after frees, re-get pointers
+	meta = shpointer(shm, arena);
+	if(meta->keys >= 0)
+	{
+		struct j_keys *ks = shpointer(shm, meta->keys);
+		for(long i = 0; i < ks->cap; i++)
+			if(ks->slots[i] >= 0)
+				_j_key_release(shm, ks->slots[i]);
+		shfree(shm, meta->keys);
+	}
+	sharena_free(shm, arena);
+}
+
+// stop placing values in the arena, `root` keeps it (-1 to drop it)
+static long _j_arena_end(void *shm, long root)
+{
+	long arena = _j_arena;
+	_j_arena = -1;
+	if(root < 0 || J_IMMEDIATE(root) || !J_IN_ARENA((struct j_value*)shpointer(shm, root)))
+	{
+		// failed, or top-level is an immediate, arena is not needed
+		_j_arena_free(shm, arena);
+		return root;
+	}
+	// the root has its reference already
+	((struct j_arena*)shpointer(shm, arena))->refs--;
+	return root;
+}
+
+static void _j_value_free(void *shm, long obj)
+{
+	if(J_IN_ARENA((struct j_value*)shpointer(shm, obj)))
+		_j_arena_of(shm, obj)->refs--;
+	else
+		shslab_free(shm, obj, sizeof(struct j_value));
 }
 
+// items (of lists and dicts) go where their container is
+static long _j_item_new(void *shm, long container, unsigned long size)
+{
+	if(J_IN_ARENA((struct j_value*)shpointer(shm, container)))
+		return sharena_alloc(shm, sharena_of(shm, container), size);
+	return shslab_alloc(shm, size);
+}
+
+static void _j_item_free(void *shm, long container, long item, unsigned long size)
+{
+	if(!J_IN_ARENA((struct j_value*)shpointer(shm, container)))
+		shslab_free(shm, item, size);
+}
+
+// the same arena (for nodes in one)
+#define J_SAME_ARENA(shm, obj, container)	(!J_IMMEDIATE(obj) \
+	&& J_IN_ARENA((struct j_value*)shpointer(shm, obj)) \
+	&& sharena_of(shm, obj) == sharena_of(shm, container))
+
+/*
+	the container takes the reference (of the caller) to the value,
+	arena containers keep the ones from outside (see `struct j_arena`)
+*/
+static int _j_link_value(void *shm, long container, long value)
+{
+	struct j_value *vv = J_IMMEDIATE(value) ? NULL : shpointer(shm, value);
+	if(vv && J_COLLECTION(vv) && !J_SAME_ARENA(shm, value, container) && (J_IN_ARENA(vv) || vv->refs > 1))
+		// others may change it (see `j_hash`)
+		((struct j_value*)shpointer(shm, container))->flags |= JFLAG_LENT;
+	if(J_IMMEDIATE(value) || !J_IN_ARENA((struct j_value*)shpointer(shm, container)))
+		return 0;
+	if(J_SAME_ARENA(shm, value, container))
+	{
+		// links inside the arena are not counted
+		_j_arena_of(shm, container)->refs--;
+		return 0;
+	}
+	long foreign = _j_arena_of(shm, container)->foreign;
+	if(_j_links_add(shm, &foreign, value))
+		return -1;
+	_j_arena_of(shm, container)->foreign = foreign;
+	return 0;
+}
+
+// the container gives its reference to the value to the caller
+static void _j_unlink_value(void *shm, long container, long value)
+{
+	if(J_IMMEDIATE(value) || !J_IN_ARENA((struct j_value*)shpointer(shm, container)))
+		return;
+	struct j_arena *meta = _j_arena_of(shm, container);
+	if(J_SAME_ARENA(shm, value, container))
+		meta->refs++;
+	else
+		_j_links_del(shm, &meta->foreign, value);
+}
+
+/*
+	NEW functions
+*/
+
 long j_null_new(void *shm)
 {
-	return _j_base_new(shm, &ptr_j_null, JTYPE_NULL);
+	return J_NULL;
 }
 
 long j_bool_new(void *shm, int val)
 {
-	return _j_base_new(shm, val?&ptr_j_true:&ptr_j_false, val?JTYPE_TRUE:JTYPE_FALSE);
+	return val ? J_TRUE : J_FALSE;
 }
 
 long j_int_new(void *shm, long val)
 {
 	PD("j_int_new");
-	long ptr_j_int = shmalloc(shm, sizeof(struct j_value));
+	if(val >= J_INT_MIN && val <= J_INT_MAX)
+		return _j_int_encode(val);
+	long ptr_j_int = _j_value_new(shm, JTYPE_INT);
 	if(ptr_j_int < 0)
 		return ptr_j_int;
 	struct j_value *jv = shpointer(shm, ptr_j_int);
-	jv->jtype = JTYPE_INT;
 	jv->val_integer = val;
 	return ptr_j_int;
 }
@@ -157,31 +609,40 @@ long j_int_new(void *shm, long val)
 long j_float_new(void *shm, double val)
 {
 	PD("j_float_new");
-	long j_off = shmalloc(shm, sizeof(struct j_value));
+	long j_off = _j_value_new(shm, JTYPE_FLOAT);
 	if(j_off<0)
 		return -1;
 	struct j_value *jv = shpointer(shm, j_off);
-	jv->jtype = JTYPE_FLOAT;
 	jv->val_float = val;
 	return j_off;
 }
 
-long _j_str_new(void *shm, char *str, int size)
+long j_str_new_len(void *shm, char *str, int size)
 {
-	long j_off = shmalloc(shm, sizeof(struct j_value));
+	long j_off = _j_value_new(shm, JTYPE_STR);
 	if(j_off<0)
 		return -1;
-	long s_off = shmalloc(shm, size+1);
+	if(size <= J_STR_INLINE)
+	{
+		struct j_value *jv = shpointer(shm, j_off);
+		jv->flags |= JFLAG_INLINE;
+		memcpy(jv->str_inline, str, size);
+		jv->str_inline[size] = 0;
+		jv->str_inline_len = size;
+		return j_off;
+	}
+	long s_off = _j_arena >= 0 ? sharena_alloc(shm, _j_arena, size+1) : shmalloc(shm, size+1);
 	if(s_off<0)
 	{
-		shfree(shm, j_off);
+		_j_value_free(shm, j_off);
 		return -1;
 	}
 	memcpy(shpointer(shm, s_off), str, size);
 	((char*)shpointer(shm, s_off))[size] = 0;
 	struct j_value *jv = shpointer(shm, j_off);
-	jv->jtype = JTYPE_STR;
 	jv->str_val = s_off;
+	jv->str_len = size;
+	jv->str_hash = 0;
 	return j_off;
 }
 
@@ -189,51 +650,239 @@ long j_str_new(void *shm, char *str)
 {
 	if(!str)
 		return -1;
-	return _j_str_new(shm, str, strlen(str));
+	return j_str_new_len(shm, str, strlen(str));
 }
 
 long j_list_new(void *shm)
 {
-	long j_off = shmalloc(shm, sizeof(struct j_value));
+	long j_off = _j_value_new(shm, JTYPE_LIST);
 	if(j_off<0)
 		return -1;
 	struct j_value *jv = shpointer(shm, j_off);
-	jv->jtype = JTYPE_LIST;
-	jv->ptr_list_head = jv->ptr_list_tail = -1;
+	jv->ptr_list_buf = -1;
 	jv->list_len = 0;
+	jv->list_hash = 0;
 	return j_off;
 }
 
 long j_dict_new(void *shm)
 {
-	long j_off = shmalloc(shm, sizeof(struct j_value));
+	long j_off = _j_value_new(shm, JTYPE_DICT);
 	if(j_off<0)
 		return -1;
 	struct j_value *jv = shpointer(shm, j_off);
-	jv->jtype = JTYPE_DICT;
-	jv->ptr_dict_head = jv->ptr_dict_tail = -1;
+	jv->ptr_dict_table = -1;
 	jv->dict_len = 0;
+	jv->dict_hash = 0;
 	return j_off;
 }
 
+long j_arena_new(void *shm, int jtype)
+{
+	if(jtype != JTYPE_DICT && jtype != JTYPE_LIST)
+		return -1;
+	if(_j_arena_begin(shm))
+		return -1;
+	long obj = jtype == JTYPE_DICT ? j_dict_new(shm) : j_list_new(shm);
+	return _j_arena_end(shm, obj);
+}
+
+long j_ref(void *shm, long obj)
+{
+	if(J_IMMEDIATE(obj))
+		return obj;
+	struct j_value *jv = shpointer(shm, obj);
+	if(J_IN_ARENA(jv))
+		_j_arena_of(shm, obj)->refs++;
+	else if(jv->refs < J_REFS_MAX)
+		jv->refs++;
+	return obj;
+}
+
+/*
+	COPIES
+
+	A copy of a dict/list shares its table (or buffer) with the
+	original, these count the containers using them (`refs`), and
+	the first one that changes it, or hands out one of the values in
+	it (see `j_unshare`), gets one of its own, with copies of the
+	dicts/lists in it, that share theirs in turn. It's copied one
+	level at a time, only where it's used.
+
+	The dicts/lists in a shared table are the ones of the container
+	that had it first (`JFLAG_OWNER`), it keeps these when it gets its
+	own (so their handlers stay with it), the others get copies.
+
+	Nodes of arenas don't share their tables, these are copied in full.
+*/
+
+// both start with it, `ptr_dict_table` and `ptr_list_buf` are in the same place too
+#define J_TABLE_REFS(shm, jv)	(*(int*)shpointer(shm, (jv)->ptr_list_buf))
+
+static long _j_clone(void *shm, long obj);
+
+// a new dict/list with the same table as this one (not in an arena), -1 on failure
+static long _j_share(void *shm, long obj)
+{
+	long copy = _j_value_new(shm, ((struct j_value*)shpointer(shm, obj))->jtype);
+	if(copy < 0)
+		return -1;
+	// after malloc, re-get pointers
+	struct j_value *jv = shpointer(shm, obj);
+	struct j_value *cv = shpointer(shm, copy);
+	cv->ptr_list_buf = jv->ptr_list_buf;
+	cv->list_len = jv->list_len;
+	cv->list_hash = jv->list_hash;
+	// what it has is also there
+	cv->flags |= jv->flags & JFLAG_LENT;
+	if(jv->ptr_list_buf >= 0 && J_TABLE_REFS(shm, jv)++ == 1)
+		// had it first
+		jv->flags |= JFLAG_OWNER;
+	return copy;
+}
+
+// the `n`th value in the table (or buffer) of the dict/list, NULL if deleted
+static long *_j_table_slot(void *shm, struct j_value *jv, int n)
+{
+	if(jv->jtype == JTYPE_LIST)
+		return &J_LIST_AT((struct j_list_buf*)shpointer(shm, jv->ptr_list_buf), n);
+	struct j_dict_entry *e = ((struct j_dict_table*)shpointer(shm, jv->ptr_dict_table))->entries + n;
+	return e->key < 0 ? NULL : &e->ptr_value;
+}
+
+static int _j_table_slots(void *shm, struct j_value *jv)
+{
+	if(jv->jtype == JTYPE_LIST)
+		return jv->list_len;
+	return ((struct j_dict_table*)shpointer(shm, jv->ptr_dict_table))->used;
+}
+
+/*
+	the dict/list gets a table of its own, if it's shared, with copies
+	(or references) of the values, -1 on failure (nothing changes then)
+*/
+static int _j_unshare(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	if(jv->ptr_list_buf < 0 || J_TABLE_REFS(shm, jv) == 1)
+		return 0;
+	unsigned long size = jv->jtype == JTYPE_LIST
+		? J_LIST_SIZE(((struct j_list_buf*)shpointer(shm, jv->ptr_list_buf))->cap)
+		: J_DICT_SIZE(((struct j_dict_table*)shpointer(shm, jv->ptr_dict_table))->cap);
+	long off = _j_item_new(shm, obj, size);
+	if(off < 0)
+		return -1;
+	// after malloc, re-get pointers
+	jv = shpointer(shm, obj);
+	long shared = jv->ptr_list_buf;
+	memcpy(shpointer(shm, off), shpointer(shm, shared), size);
+	*(int*)shpointer(shm, off) = 1;
+	// copies into the new one (it's just this one's for now)
+	jv->ptr_list_buf = off;
+	int n, slots = _j_table_slots(shm, jv);
+	for(n = 0; n < slots; n++)
+	{
+		long *slot = _j_table_slot(shm, jv, n);
+		if(!slot || J_IMMEDIATE(*slot))
+			continue;
+		long value = _j_clone(shm, *slot);
+		if(value < 0)
+			break;
+		// after malloc, re-get pointers
+		jv = shpointer(shm, obj);
+		*_j_table_slot(shm, jv, n) = value;
+	}
+	if(n < slots)
+	{
+		// undo it
+		while(n--)
+		{
+			long *slot = _j_table_slot(shm, jv, n);
+			if(slot && !J_IMMEDIATE(*slot))
+				j_free(shm, *slot);
+		}
+		jv->ptr_list_buf = shared;
+		_j_item_free(shm, obj, off, size);
+		return -1;
+	}
+	if(jv->jtype == JTYPE_DICT)
+		// and to the keys
+		for(n = 0; n < slots; n++)
+		{
+			struct j_dict_entry *e = ((struct j_dict_table*)shpointer(shm, off))->entries + n;
+			if(e->key >= 0)
+				J_KEY(shm, e->key)->refs++;
+		}
+	(*(int*)shpointer(shm, shared))--;
+	if(jv->flags & JFLAG_OWNER)
+	{
+		// it keeps its values, the copies go to the others
+		long *a = shpointer(shm, off), *b = shpointer(shm, shared);
+		// (the first has `refs`, and `cap`, the same in both)
+		for(unsigned long i = 1; i < size / sizeof(long); i++)
+		{
+			long t = a[i];
+			a[i] = b[i];
+			b[i] = t;
+		}
+		jv->flags &= ~JFLAG_OWNER;
+	}
+	return 0;
+}
+
+long j_copy(void *shm, long obj)
+{
+	return _j_clone(shm, obj);
+}
+
+int j_unshare_needed(void *shm, long obj)
+{
+	if(J_IMMEDIATE(obj))
+		return 0;
+	struct j_value *jv = shpointer(shm, obj);
+	if(!J_COLLECTION(jv))
+		return 0;
+	return !(jv->flags & JFLAG_LENT && (jv->ptr_list_buf < 0 || J_TABLE_REFS(shm, jv) == 1));
+}
+
+int j_unshare(void *shm, long obj)
+{
+	if(!j_unshare_needed(shm, obj))
+		return 0;
+	if(shmem_locked(shm) == SHMEM_LOCK_READ)
+		return -1;
+	// what it hands out may be changed (see `j_hash`)
+	((struct j_value*)shpointer(shm, obj))->flags |= JFLAG_LENT;
+	return _j_unshare(shm, obj);
+}
+
 /*
 	FREE functions
 */
 
 void j_free(void *shm, long obj)
 {
+	if(J_IMMEDIATE(obj))
+		// nothing to do here
+		return;
 	struct j_value *jv = shpointer(shm, obj);
+	if(J_IN_ARENA(jv))
+	{
+		// nodes in arenas all go away at once, with the last reference
+		long arena = sharena_of(shm, obj);
+		if(!--((struct j_arena*)shpointer(shm, arena))->refs)
+			_j_arena_free(shm, arena);
+		return;
+	}
+	if(jv->refs == J_REFS_MAX || --jv->refs)
+		// still used (handlers have their own)
+		return;
 	switch(jv->jtype)
 	{
-		case JTYPE_NULL:
-		case JTYPE_TRUE:
-		case JTYPE_FALSE:
-			// nothing to do here
-			break;
 		case JTYPE_INT:
 		case JTYPE_FLOAT:
 			// quite basic
-			shfree(shm, obj);
+			shslab_free(shm, obj, sizeof(struct j_value));
 			break;
 		case JTYPE_STR:
 			j_str_free(shm, obj);
@@ -261,50 +910,91 @@ void j_bool_free(void *shm, long obj)
 
 void j_int_free(void *shm, long obj)
 {
-	shfree(shm, obj);
+	if(J_IMMEDIATE(obj))
+		return;
+	shslab_free(shm, obj, sizeof(struct j_value));
 }
 
 void j_float_free(void *shm, long obj)
 {
-	shfree(shm, obj);
+	shslab_free(shm, obj, sizeof(struct j_value));
 }
 
 void j_str_free(void *shm, long obj)
 {
 	struct j_value *jv = shpointer(shm, obj);
-	shfree(shm, jv->str_val);
-	shfree(shm, obj);
+	if(!(jv->flags & JFLAG_INLINE))
+		shfree(shm, jv->str_val);
+	shslab_free(shm, obj, sizeof(struct j_value));
+}
+
+/*
+	a dict/list going away, with its table still used by others, leaves
+	copies of its values there (these may have other references), and
+	just its reference to the table, 1 if that's it
+*/
+static int _j_table_leave(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	if(jv->ptr_list_buf < 0 || J_TABLE_REFS(shm, jv) == 1)
+		return 0;
+	if(jv->flags & JFLAG_OWNER)
+	{
+		int slots = _j_table_slots(shm, jv);
+		for(int n = 0; n < slots; n++)
+		{
+			long *slot = _j_table_slot(shm, jv, n);
+			if(!slot || J_IMMEDIATE(*slot) || !J_COLLECTION((struct j_value*)shpointer(shm, *slot)))
+				continue;
+			long value = _j_clone(shm, *slot);
+			if(value < 0)
+				// it's fine, the others get this one
+				continue;
+			// after malloc, re-get pointers
+			jv = shpointer(shm, obj);
+			slot = _j_table_slot(shm, jv, n);
+			j_free(shm, *slot);
+			*slot = value;
+		}
+	}
+	J_TABLE_REFS(shm, jv)--;
+	shslab_free(shm, obj, sizeof(struct j_value));
+	return 1;
 }
 
 void j_list_free(void *shm, long obj)
 {
-	// free internal list
+	if(_j_table_leave(shm, obj))
+		return;
 	struct j_value *jv = shpointer(shm, obj);
-	while(jv->ptr_list_head >= 0)
+	if(jv->ptr_list_buf >= 0)
 	{
-		long ptr_this = jv->ptr_list_head;
-		struct j_list_item *li = shpointer(shm, ptr_this);
-		jv->ptr_list_head = li->ptr_next_item;
-		j_free(shm, li->ptr_value);
-		shfree(shm, ptr_this);
+		struct j_list_buf *b = shpointer(shm, jv->ptr_list_buf);
+		for(int i = 0; i < jv->list_len; i++)
+			j_free(shm, J_LIST_AT(b, i));
+		shslab_free(shm, jv->ptr_list_buf, J_LIST_SIZE(b->cap));
 	}
-	shfree(shm, obj);
+	shslab_free(shm, obj, sizeof(struct j_value));
 }
 
 void j_dict_free(void *shm, long obj)
 {
-	// free internal list
+	if(_j_table_leave(shm, obj))
+		return;
 	struct j_value *jv = shpointer(shm, obj);
-	while(jv->ptr_dict_head >= 0)
+	if(jv->ptr_dict_table >= 0)
 	{
-		long ptr_this = jv->ptr_list_head;
-		struct j_dict_item *di = shpointer(shm, ptr_this);
-		jv->ptr_dict_head = di->ptr_next_item;
-		shfree(shm, di->str_key);
-		j_free(shm, di->ptr_value);
-		shfree(shm, ptr_this);
+		struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+		for(int i = 0; i < t->used; i++)
+		{
+			if(t->entries[i].key < 0)
+				continue;
+			_j_key_release(shm, t->entries[i].key);
+			j_free(shm, t->entries[i].ptr_value);
+		}
+		shfree(shm, jv->ptr_dict_table);
 	}
-	shfree(shm, obj);
+	shslab_free(shm, obj, sizeof(struct j_value));
 }
 
 /*
@@ -313,6 +1003,14 @@ void j_dict_free(void *shm, long obj)
 
 int j_type(void *shm, long obj)
 {
+	if(obj < 0)
+		return -1;
+	if(J_IMMEDIATE(obj))
+	{
+		if(obj & 1)
+			return JTYPE_INT;
+		return obj == J_NULL ? JTYPE_NULL : obj == J_TRUE ? JTYPE_TRUE : JTYPE_FALSE;
+	}
 	struct j_value *jv = shpointer(shm, obj);
 	return jv->jtype;
 }
@@ -323,17 +1021,28 @@ int j_type(void *shm, long obj)
 
 long j_int_val(void *shm, long obj)
 {
+	if(J_IMMEDIATE(obj))
+		return _j_int_decode(obj);
 	return ((struct j_value*)shpointer(shm, obj))->val_integer;
 }
 
 double j_float_val(void *shm, long obj)
 {
-	return ((struct j_value*)shpointer(shm, obj))->val_integer;
+	return ((struct j_value*)shpointer(shm, obj))->val_float;
 }
 
-char *j_str_val(void *shm, long obj)
+char *j_str_val(void *shm, long obj, int *len)
 {
-	return shpointer(shm, ((struct j_value*)shpointer(shm, obj))->str_val);
+	struct j_value *jv = shpointer(shm, obj);
+	if(jv->flags & JFLAG_INLINE)
+	{
+		if(len)
+			*len = jv->str_inline_len;
+		return jv->str_inline;
+	}
+	if(len)
+		*len = jv->str_len;
+	return shpointer(shm, jv->str_val);
 }
 
 
@@ -343,246 +1052,551 @@ char *j_str_val(void *shm, long obj)
 
 long j_list_get(void *shm, long obj, int index)
 {
-	if(index < 0)
+	struct j_value *jv = shpointer(shm, obj);
+	if(index < 0 || index >= jv->list_len)
 		return -1;
+	return J_LIST_AT((struct j_list_buf*)shpointer(shm, jv->ptr_list_buf), index);
+}
+
+// FNV-1a
+static unsigned long _j_hash(char *key, int key_len)
+{
+	unsigned long hash = 0xcbf29ce484222325UL;
+	for(int i = 0; i < key_len; i++)
+		hash = (hash ^ (unsigned char)key[i]) * 0x100000001b3UL;
+	return hash;
+}
+
+// hash of a (not inline) string, worked out the first time it's needed
+static unsigned long _j_str_hash(void *shm, long obj)
+{
 	struct j_value *jv = shpointer(shm, obj);
-	long ptr_item;
-	struct j_list_item *li;
-	for(ptr_item = jv->ptr_list_head; index; index--)
+	if(jv->str_hash)
+		return jv->str_hash;
+	unsigned long hash = _j_hash(shpointer(shm, jv->str_val), jv->str_len) | 1;
+	// readers share the lock, these don't write (see `j_hash`)
+	if(shmem_locked(shm) != SHMEM_LOCK_READ)
+		jv->str_hash = hash;
+	return hash;
+}
+
+// position of the key (atom) in the entries of the dict, -1 if not there
+static int _j_dict_find(void *shm, struct j_value *jv, long key)
+{
+	if(jv->ptr_dict_table < 0 || key < 0)
+		return -1;
+	struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+	int *index = J_DICT_INDEX(t);
+	unsigned int mask = (t->cap << 1) - 1;
+	// deleted ones stay in the index (with no key), until it's rebuilt
+	for(unsigned int i = J_KEY(shm, key)->hash & mask; index[i] >= 0; i = (i+1) & mask)
+		if(t->entries[index[i]].key == key)
+			return index[i];
+	return -1;
+}
+
+long j_dict_get_len(void *shm, long obj, char *key, int key_len)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	int pos = _j_dict_find(shm, jv, _j_key_find(shm, key, key_len, _j_hash(key, key_len)));
+	if(pos < 0)
+		return -1;
+	return ((struct j_dict_table*)shpointer(shm, jv->ptr_dict_table))->entries[pos].ptr_value;
+}
+
+long j_dict_get(void *shm, long obj, char *key)
+{
+	return j_dict_get_len(shm, obj, key, strlen(key));
+}
+
+/*
+	HASH functions
+
+	Equal values (as `j_cmp` sees them) have the same hash. Dicts and
+	lists keep a sum of theirs (`dict_hash`, `list_hash`), and update
+	it as they change, rather than going through all of their values
+	again:
+	- dicts add up a hash of each entry, the order doesn't matter
+	- lists add up the hash of each value times `J_HASH_P` to the power
+	  of its index, so values at either end are added and taken out
+	  without going through the others (the middle ones do, later)
+	Sums are of 63 bits, the top one is set on the ones kept, 0 if
+	not known (yet).
+
+	Values taken out of a dict/list (see `j_unshare`), or set into it
+	while others have them, may be changed without it knowing, its sum
+	is not kept then (`JFLAG_LENT`), it's worked out from the hashes of
+	the values (most of which are).
+
+	Hashes worked out holding just the read lock (see `shmem_lock`) are
+	not kept, other readers may be looking at the same values.
+*/
+#define J_HASH_P	0x9e3779b97f4a7c15UL
+#define J_HASH_PINV	0xf1de83e19937733dUL	// `J_HASH_P * J_HASH_PINV` is 1
+#define J_HASH_MASK	(~0UL >> 1)
+#define J_HASH_KEPT	(1UL << 63)
+// `dict_hash` and `list_hash` are in the same place
+#define J_HASH_KEEPS(jv)	((jv)->list_hash && !((jv)->flags & JFLAG_LENT))
+
+// splitmix64
+static unsigned long _j_mix(unsigned long h)
+{
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9UL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebUL;
+	return h ^ (h >> 31);
+}
+
+static unsigned long _j_hash_pow(int n)
+{
+	unsigned long r = 1, p = J_HASH_P;
+	for(; n; n >>= 1, p *= p)
+		if(n & 1)
+			r *= p;
+	return r;
+}
+
+static unsigned long _j_entry_hash(void *shm, long key, long value)
+{
+	return _j_mix(J_KEY(shm, key)->hash + j_hash(shm, value) * J_HASH_P);
+}
+
+// the sum of the dict/list, kept for next time if it can be
+static unsigned long _j_items_hash(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	if(J_HASH_KEEPS(jv))
+		return jv->list_hash & J_HASH_MASK;
+	unsigned long sum = 0;
+	if(jv->jtype == JTYPE_LIST && jv->list_len)
 	{
-		if(ptr_item < 0)
-			return -1;
-		li = shpointer(shm, ptr_item);
-		ptr_item = li->ptr_next_item;
+		struct j_list_buf *b = shpointer(shm, jv->ptr_list_buf);
+		unsigned long p = 1;
+		for(int i = 0; i < jv->list_len; i++, p *= J_HASH_P)
+			sum += j_hash(shm, J_LIST_AT(b, i)) * p;
 	}
-	li = shpointer(shm, ptr_item);
-	return li->ptr_value;
+	else if(jv->jtype == JTYPE_DICT && jv->dict_len)
+	{
+		struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+		for(int pos = 0; pos < t->used; pos++)
+			if(t->entries[pos].key >= 0)
+				sum += _j_entry_hash(shm, t->entries[pos].key, t->entries[pos].ptr_value);
+	}
+	sum &= J_HASH_MASK;
+	if(!(jv->flags & JFLAG_LENT) && shmem_locked(shm) != SHMEM_LOCK_READ)
+		jv->list_hash = sum | J_HASH_KEPT;
+	return sum;
 }
 
-long j_dict_get(void *shm, long obj, char *key)
+unsigned long j_hash(void *shm, long obj)
+{
+	int type = j_type(shm, obj);
+	switch(type)
+	{
+		case JTYPE_INT:
+			return _j_mix(_j_mix(j_int_val(shm, obj)) + type);
+		case JTYPE_FLOAT: {
+			// -0.0 is equal to 0.0
+			double val = ((struct j_value*)shpointer(shm, obj))->val_float;
+			unsigned long bits = 0;
+			if(val != 0)
+				memcpy(&bits, &val, sizeof(bits));
+			return _j_mix(_j_mix(bits) + type);
+		}
+		case JTYPE_STR: {
+			struct j_value *jv = shpointer(shm, obj);
+			if(jv->flags & JFLAG_INLINE)
+				return _j_mix((_j_hash(jv->str_inline, jv->str_inline_len) | 1) + type);
+			return _j_mix(_j_str_hash(shm, obj) + type);
+		}
+		case JTYPE_LIST:
+		case JTYPE_DICT:
+			return _j_mix(_j_items_hash(shm, obj) + type);
+	}
+	return _j_mix(type);
+}
+
+/*
+	the sum (if it's kept) of a dict/list when the value at `index` (of
+	the list), or at `key` (atom, of the dict), changes from `prev` to
+	`value`, -1 if there's none (added, or taken out)
+*/
+static void _j_rehash(void *shm, long obj, int index, long key, long prev, long value)
 {
 	struct j_value *jv = shpointer(shm, obj);
-	long ptr_item;
-	struct j_dict_item *di;
-	for(ptr_item = jv->ptr_dict_head; ptr_item >= 0; ptr_item = di->ptr_next_item)
+	if(!J_HASH_KEEPS(jv))
+		return;
+	unsigned long sum = jv->list_hash;
+	if(jv->jtype == JTYPE_DICT)
 	{
-		di = shpointer(shm, ptr_item);
-		char *s = shpointer(shm, di->str_key);
-		if(!strcmp(s, key))
-			return di->ptr_value;
+		if(prev >= 0)
+			sum -= _j_entry_hash(shm, key, prev);
+		if(value >= 0)
+			sum += _j_entry_hash(shm, key, value);
 	}
-	return -1;
+	else
+	{
+		unsigned long p = _j_hash_pow(index);
+		if(prev >= 0)
+			sum -= j_hash(shm, prev) * p;
+		if(value >= 0)
+			sum += j_hash(shm, value) * p;
+	}
+	jv->list_hash = (sum & J_HASH_MASK) | J_HASH_KEPT;
 }
 
 /*
 	SET functions
 */
 
-int j_list_set(void *shm, long obj, int index, long value)
+// move the values to a new buffer, with `cap` (a power of 2) slots
+static int _j_list_resize(void *shm, long obj, int cap)
 {
+	long off = _j_item_new(shm, obj, J_LIST_SIZE(cap));
+	if(off < 0)
+		return -1;
+	// after malloc, re-get pointers
 	struct j_value *jv = shpointer(shm, obj);
-	// where to put it?
-	if(index < 0)
+	struct j_list_buf *nb = shpointer(shm, off);
+	nb->refs = 1;
+	nb->cap = cap;
+	nb->head = 0;
+	if(jv->ptr_list_buf >= 0)
 	{
-		// append
-		long ptr_new_item = shmalloc(shm, sizeof(struct j_list_item));
-		if(ptr_new_item < 0)
-			return -1;
+		struct j_list_buf *b = shpointer(shm, jv->ptr_list_buf);
+		// in (at most) two pieces, if it wraps around
+		int first = b->cap - b->head;
+		if(first > jv->list_len)
+			first = jv->list_len;
+		memcpy(nb->values, b->values + b->head, first * sizeof(long));
+		memcpy(nb->values + first, b->values, (jv->list_len - first) * sizeof(long));
+		_j_item_free(shm, obj, jv->ptr_list_buf, J_LIST_SIZE(b->cap));
+	}
+	jv->ptr_list_buf = off;
+	return 0;
+}
+
+// make room for one more value
+static struct j_list_buf *_j_list_reserve(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	struct j_list_buf *b = jv->ptr_list_buf < 0 ? NULL : shpointer(shm, jv->ptr_list_buf);
+	if(!b || jv->list_len == b->cap)
+	{
+		if(_j_list_resize(shm, obj, b ? b->cap << 1 : J_LIST_MIN))
+			return NULL;
 		jv = shpointer(shm, obj);
-		struct j_list_item *ji = shpointer(shm, ptr_new_item);
-		ji->ptr_value = value;
-		ji->ptr_next_item = -1;
-		if(jv->ptr_list_tail == -1)
-			jv->ptr_list_head = jv->ptr_list_tail = ptr_new_item;
-		else
-		{
-			struct j_list_item *tail = shpointer(shm, jv->ptr_list_tail);
-			tail->ptr_next_item = ptr_new_item;
-			jv->ptr_list_tail = ptr_new_item;
-		}
-		jv->list_len++;
-		return 0;
+		b = shpointer(shm, jv->ptr_list_buf);
 	}
+	return b;
+}
+
+/*
+	move the values before `index` one position back (`dir` -1) or the
+	ones after it one forward (`dir` 1), whichever side is shorter is
+	what the callers pick
+*/
+static void _j_list_move(struct j_list_buf *b, int len, int index, int dir)
+{
+	int i;
+	if(dir < 0)
+		for(i = 0; i < index; i++)
+			J_LIST_AT(b, i-1) = J_LIST_AT(b, i);
 	else
+		for(i = len; i > index; i--)
+			J_LIST_AT(b, i) = J_LIST_AT(b, i-1);
+}
+
+int j_list_insert(void *shm, long obj, int index, long value)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	if(index < 0 || index > jv->list_len || _j_unshare(shm, obj))
+		return -1;
+	struct j_list_buf *b = _j_list_reserve(shm, obj);
+	if(!b || _j_link_value(shm, obj, value))
+		return -1;
+	jv = shpointer(shm, obj);
+	if(index < jv->list_len >> 1)
 	{
-		// update
-		long ptr_iter = jv->ptr_list_head;
-		struct j_list_item *iter;
-		for(ptr_iter = jv->ptr_list_head; ptr_iter >= 0; ptr_iter = iter->ptr_next_item)
-		{
-			iter = shpointer(shm, ptr_iter);
-			if(!index)
-			{
-				// set it here
-				// free previous
-				j_free(shm, iter->ptr_value);
-				iter->ptr_value = value;
-				return 0;
-			}
-			index--;
-		}
+		// open the gap at the front
+		_j_list_move(b, jv->list_len, index, -1);
+		b->head = (b->head - 1) & (b->cap - 1);
 	}
-	// index not found
-	return -1;
+	else
+		_j_list_move(b, jv->list_len, index, 1);
+	J_LIST_AT(b, index) = value;
+	jv->list_len++;
+	if(index == jv->list_len - 1)
+		_j_rehash(shm, obj, index, -1, -1, value);
+	else if(!index)
+	{
+		// the others move one up
+		if(J_HASH_KEEPS(jv))
+			jv->list_hash = ((jv->list_hash * J_HASH_P + j_hash(shm, value)) & J_HASH_MASK) | J_HASH_KEPT;
+	}
+	else
+		// worked out again, when needed
+		jv->list_hash = 0;
+	return 0;
+}
+
+int j_list_set(void *shm, long obj, int index, long value)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	// where to put it?
+	if(index < 0)
+		// append
+		return j_list_insert(shm, obj, jv->list_len, value);
+	if(index >= jv->list_len)
+		// index not found
+		return -1;
+	// update, release previous
+	if(_j_unshare(shm, obj) || _j_link_value(shm, obj, value))
+		return -1;
+	// after malloc, re-get pointers
+	jv = shpointer(shm, obj);
+	struct j_list_buf *b = shpointer(shm, jv->ptr_list_buf);
+	long prev = J_LIST_AT(b, index);
+	J_LIST_AT(b, index) = value;
+	_j_rehash(shm, obj, index, -1, prev, value);
+	_j_unlink_value(shm, obj, prev);
+	j_free(shm, prev);
+	return 0;
 }
 
+int j_list_push(void *shm, long obj, long value)
+{
+	return j_list_insert(shm, obj, j_list_len(shm, obj), value);
+}
 
-int _j_dict_set(void *shm, long obj, char *key, int key_len, long value)
+int j_list_unshift(void *shm, long obj, long value)
 {
+	return j_list_insert(shm, obj, 0, value);
+}
+
+
+/*
+	(re)build the table of the dict, with `cap` entries (a power of 2),
+	the deleted ones are dropped
+*/
+static int _j_dict_resize(void *shm, long obj, int cap)
+{
+	long off = _j_item_new(shm, obj, J_DICT_SIZE(cap));
+	if(off < 0)
+		return -1;
+	// after malloc, re-get pointers
 	struct j_value *jv = shpointer(shm, obj);
-	// look for item first
+	struct j_dict_table *nt = shpointer(shm, off);
+	nt->refs = 1;
+	nt->cap = cap;
+	nt->used = 0;
+	int *index = J_DICT_INDEX(nt);
+	unsigned int mask = (cap << 1) - 1;
+	memset(index, 0xff, (cap << 1) * sizeof(int));
+	if(jv->ptr_dict_table >= 0)
 	{
-		long ptr_iter;
-		struct j_dict_item *di;
-		for(ptr_iter = jv->ptr_dict_head; ptr_iter >= 0; ptr_iter = di->ptr_next_item)
+		struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+		for(int pos = 0; pos < t->used; pos++)
 		{
-			di = shpointer(shm, ptr_iter);
-			char *s = shpointer(shm, di->str_key);
-			if(!memcmp(s, key, key_len))
-			{
-				// update this one
-				j_free(shm, di->ptr_value);
-				di->ptr_value = value;
-				return 0;
-			}
+			if(t->entries[pos].key < 0)
+				continue;
+			unsigned int i;
+			for(i = J_KEY(shm, t->entries[pos].key)->hash & mask; index[i] >= 0; i = (i+1) & mask);
+			index[i] = nt->used;
+			nt->entries[nt->used++] = t->entries[pos];
 		}
+		_j_item_free(shm, obj, jv->ptr_dict_table, J_DICT_SIZE(t->cap));
 	}
-	// key not found, create it
+	jv->ptr_dict_table = off;
+	return 0;
+}
+
+/*
+	add a new item (the key is not there), at the end, `key` is an
+	atom with a reference for it (see `_j_key_intern`)
+*/
+static int _j_dict_append(void *shm, long obj, long key, long value)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	struct j_dict_table *t = jv->ptr_dict_table < 0 ? NULL : shpointer(shm, jv->ptr_dict_table);
+	if(!t || t->used == t->cap)
 	{
-		long ptr_new_item = shmalloc(shm, sizeof(struct j_dict_item));
-		if(ptr_new_item < 0)
-			return -1;
-		long str_key = shmalloc(shm, key_len+1);
-		if(str_key < 0)
-		{
-			shfree(shm, ptr_new_item);
+		// grow it, or just drop the deleted ones
+		int cap = J_DICT_MIN;
+		while(cap < jv->dict_len * 2)
+			cap <<= 1;
+		if(_j_dict_resize(shm, obj, cap))
 			return -1;
-		}
-		// after malloc, re-get pointers
 		jv = shpointer(shm, obj);
-		memcpy(shpointer(shm, str_key), key, key_len);
-		((char*)shpointer(shm, str_key))[key_len] = 0;
-		struct j_dict_item *di = shpointer(shm, ptr_new_item);
-		di->ptr_next_item = -1;
-		di->str_key = str_key;
-		di->ptr_value = value;
-		// append to list
-		if(jv->ptr_dict_tail < 0)
-		{
-			jv->ptr_dict_head = jv->ptr_dict_tail = ptr_new_item;
-		}
+	}
+	if(_j_link_value(shm, obj, value))
+		return -1;
+	jv = shpointer(shm, obj);
+	if(J_IN_ARENA(jv))
+	{
+		// the arena keeps one reference, for all its dicts
+		struct j_arena *meta = _j_arena_of(shm, obj);
+		if(meta->keys >= 0 && _j_keys_slot(shm, shpointer(shm, meta->keys), key) >= 0)
+			J_KEY(shm, key)->refs--;
 		else
 		{
-			struct j_dict_item *tail = shpointer(shm, jv->ptr_dict_tail);
-			tail->ptr_next_item = jv->ptr_dict_tail = ptr_new_item;
+			long keys = _j_keys_add(shm, meta->keys, key);
+			if(keys < 0)
+			{
+				_j_unlink_value(shm, obj, value);
+				return -1;
+			}
+			_j_arena_of(shm, obj)->keys = keys;
 		}
-		jv->dict_len++;
 	}
+	// after malloc, re-get pointers
+	jv = shpointer(shm, obj);
+	t = shpointer(shm, jv->ptr_dict_table);
+	int *index = J_DICT_INDEX(t);
+	unsigned int mask = (t->cap << 1) - 1;
+	unsigned int i;
+	for(i = J_KEY(shm, key)->hash & mask; index[i] >= 0; i = (i+1) & mask);
+	index[i] = t->used;
+	struct j_dict_entry *e = t->entries + t->used++;
+	e->key = key;
+	e->ptr_value = value;
+	jv->dict_len++;
+	_j_rehash(shm, obj, 0, key, -1, value);
+	return 0;
+}
 
+int j_dict_set_len(void *shm, long obj, char *key, int key_len, long value)
+{
+	if(_j_unshare(shm, obj))
+		return -1;
+	long atom = _j_key_intern(shm, key, key_len, _j_hash(key, key_len));
+	if(atom < 0)
+		return -1;
+	struct j_value *jv = shpointer(shm, obj);
+	int pos = _j_dict_find(shm, jv, atom);
+	if(pos >= 0)
+	{
+		// update this one, it has the key already
+		_j_key_release(shm, atom);
+		if(_j_link_value(shm, obj, value))
+			return -1;
+		// after malloc, re-get pointers
+		jv = shpointer(shm, obj);
+		struct j_dict_entry *e = ((struct j_dict_table*)shpointer(shm, jv->ptr_dict_table))->entries + pos;
+		long prev = e->ptr_value;
+		e->ptr_value = value;
+		_j_rehash(shm, obj, 0, atom, prev, value);
+		_j_unlink_value(shm, obj, prev);
+		j_free(shm, prev);
+		return 0;
+	}
+	// key not found, create it
+	if(_j_dict_append(shm, obj, atom, value))
+	{
+		_j_key_release(shm, atom);
+		return -1;
+	}
 	return 0;
 }
 
 int j_dict_set(void *shm, long obj, char *key, long value)
 {
-	return _j_dict_set(shm, obj, key, strlen(key), value);
+	return j_dict_set_len(shm, obj, key, strlen(key), value);
 }
 
 /*
 	DEL functions
 */
 
-int j_list_del(void *shm, long obj, int index)
+// take the value out of the list, -1 if not there
+static long _j_list_remove(void *shm, long obj, int index)
 {
-	if(index < 0)
-		return -1;
 	struct j_value *jv = shpointer(shm, obj);
-	if(jv->ptr_list_head < 0)
+	if(index < 0 || index >= jv->list_len || _j_unshare(shm, obj))
 		return -1;
-	long ptr_iter;
-	if(!index)	// index == 0
-	{
-		// it's the head
-		ptr_iter = jv->ptr_list_tail;
-		struct j_list_item *li;
-		if(jv->ptr_list_tail == jv->ptr_list_head)
-		{
-			jv->ptr_list_head = jv->ptr_list_tail = -1;
-		}
-		else
-		{
-			// reuse var
-			li = shpointer(shm, jv->ptr_list_head);
-			jv->ptr_list_head = li->ptr_next_item;
-		}
-		li = shpointer(shm, ptr_iter);
-		j_free(shm, li->ptr_value);
-		shfree(shm, ptr_iter);
-		jv->list_len --;
-		return 0;
-	}
-	index--;	// skip one because we delete the one after
-	for(ptr_iter = jv->ptr_list_head; index; index--)
+	// after malloc, re-get pointers
+	jv = shpointer(shm, obj);
+	struct j_list_buf *b = shpointer(shm, jv->ptr_list_buf);
+	long value = J_LIST_AT(b, index);
+	if(index == jv->list_len - 1)
+		_j_rehash(shm, obj, index, -1, value, -1);
+	else if(!index)
 	{
-		struct j_list_item *li = shpointer(shm, ptr_iter);
-		ptr_iter = li->ptr_next_item;
-		// also, check after
-		if(ptr_iter < 0)
-			return -1;
+		// the others move one down
+		if(J_HASH_KEEPS(jv))
+			jv->list_hash = (((jv->list_hash - j_hash(shm, value)) * J_HASH_PINV) & J_HASH_MASK) | J_HASH_KEPT;
 	}
-	// delete it
+	else
+		jv->list_hash = 0;
+	if(index < jv->list_len >> 1)
 	{
-		struct j_list_item *prev = shpointer(shm, ptr_iter);
-		long ptr_delete = prev->ptr_next_item;
-		struct j_list_item *to_delete = shpointer(shm, ptr_delete);
-		prev->ptr_next_item = to_delete->ptr_next_item;
-		if(prev->ptr_next_item < 0)
-		{
-			// we deleted the tail
-			jv->ptr_list_tail = ptr_iter;
-		}
-		j_free(shm, to_delete->ptr_value);
-		shfree(shm, ptr_delete);
+		// close the gap from the front
+		for(int i = index; i > 0; i--)
+			J_LIST_AT(b, i) = J_LIST_AT(b, i-1);
+		b->head = (b->head + 1) & (b->cap - 1);
 	}
-	jv->list_len --;
+	else
+		for(int i = index + 1; i < jv->list_len; i++)
+			J_LIST_AT(b, i-1) = J_LIST_AT(b, i);
+	jv->list_len--;
+	_j_unlink_value(shm, obj, value);
+	// mostly empty, give some back
+	if(b->cap > J_LIST_MIN && jv->list_len <= b->cap >> 2)
+		_j_list_resize(shm, obj, b->cap >> 1);
+	return value;
+}
+
+int j_list_del(void *shm, long obj, int index)
+{
+	long value = _j_list_remove(shm, obj, index);
+	if(value < 0)
+		return -1;
+	j_free(shm, value);
 	return 0;
 }
 
-int j_dict_del(void *shm, long obj, char*key)
+long j_list_pop(void *shm, long obj)
+{
+	return _j_list_remove(shm, obj, j_list_len(shm, obj) - 1);
+}
+
+long j_list_shift(void *shm, long obj)
+{
+	return _j_list_remove(shm, obj, 0);
+}
+
+int j_dict_del_len(void *shm, long obj, char *key, int key_len)
 {
 	struct j_value *jv = shpointer(shm, obj);
-	if(jv->ptr_dict_head < 0)
+	int pos = _j_dict_find(shm, jv, _j_key_find(shm, key, key_len, _j_hash(key, key_len)));
+	if(pos < 0 || _j_unshare(shm, obj))
 		return -1;
-	long ptr_iter, ptr_prev = -1;
-	struct j_dict_item *di;
-	for(ptr_iter = jv->ptr_dict_head; ptr_iter >= 0; ptr_prev = ptr_iter, ptr_iter = di->ptr_next_item)
+	// after malloc, re-get pointers
+	jv = shpointer(shm, obj);
+	struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+	struct j_dict_entry *e = t->entries + pos;
+	long value = e->ptr_value;
+	_j_rehash(shm, obj, 0, e->key, value, -1);
+	if(!J_IN_ARENA(jv))
+		_j_key_release(shm, e->key);
+	// it stays in the index, so lookups go past it
+	e->key = e->ptr_value = -1;
+	jv->dict_len --;
+	if(!jv->dict_len)
 	{
-		di = shpointer(shm, ptr_iter);
-		if(strcmp(shpointer(shm, di->str_key), key))
-		{
-			// not it, continue
-			continue;
-		}
-		// to leave more space to actually delete it
-		if(ptr_prev < 0)
-		{
-			// deleting HEAD
-			jv->ptr_dict_head = di->ptr_next_item;
-		}
-		else
-		{
-			struct j_dict_item *prev = shpointer(shm, ptr_prev);
-			prev->ptr_next_item = di->ptr_next_item;
-			if(ptr_iter == jv->ptr_dict_tail)
-				jv->ptr_dict_tail = ptr_prev;
-		}
-		j_free(shm, di->ptr_value);
-		shfree(shm, di->str_key);
-		shfree(shm, ptr_iter);
-		jv->dict_len --;
-		return 0;
+		// empty, start over
+		_j_item_free(shm, obj, jv->ptr_dict_table, J_DICT_SIZE(t->cap));
+		jv->ptr_dict_table = -1;
 	}
-	// else, not found
-	return -1;
+	_j_unlink_value(shm, obj, value);
+	j_free(shm, value);
+	return 0;
+}
+
+int j_dict_del(void *shm, long obj, char *key)
+{
+	return j_dict_del_len(shm, obj, key, strlen(key));
 }
 
 /*
@@ -605,42 +1619,45 @@ int j_dict_len(void *shm, long obj)
 
 int j_list_iter(void *shm, long obj, int (*callback)(void *, int, long, void *), void *user_data)
 {
-	struct j_value *jv = shpointer(shm, obj);
-	long ptr_iter;
-	struct j_list_item *li;
-	int index = 0;
 	int ret;
-	for(ptr_iter = jv->ptr_list_head; ptr_iter>=0; ptr_iter = li->ptr_next_item)
+	for(int index = 0; index < j_list_len(shm, obj); index++)
 	{
-		li = shpointer(shm, ptr_iter);
-		if((ret=callback(shm, index, li->ptr_value, user_data))!= 0)
-			return ret;
 		// in case there were `shmalloc`s there
-		li = shpointer(shm, ptr_iter);
+		if((ret=callback(shm, index, j_list_get(shm, obj, index), user_data))!= 0)
+			return ret;
 	}
 	return 0;
 }
 
-int j_dict_iter(void *shm, long obj, int (*callback)(void *, char *, long, void *), void *user_data)
+int j_dict_iter(void *shm, long obj, int (*callback)(void *, char *, int, long, void *), void *user_data)
 {
-	struct j_value *jv = shpointer(shm, obj);
-	long ptr_iter;
-	struct j_dict_item *di;
-	for(ptr_iter = jv->ptr_dict_head; ptr_iter >= 0; ptr_iter = di->ptr_next_item)
-	{
-		di = shpointer(shm, ptr_iter);
-		char *s = shpointer(shm, di->str_key);
-		int klen = strlen(s)+1;
-		char *key = malloc(klen);
+	// most keys are short, don't malloc for those
+	char buf[64];
+	for(int pos = 0; ; pos++)
+	{
+		// in case there were `shmalloc`s there
+		struct j_value *jv = shpointer(shm, obj);
+		if(jv->ptr_dict_table < 0)
+			break;
+		struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+		if(pos >= t->used)
+			break;
+		struct j_dict_entry *e = t->entries + pos;
+		if(e->key < 0)
+			// deleted
+			continue;
+		// the callback may delete the key (and its atom)
+		struct j_key *k = J_KEY(shm, e->key);
+		int klen = k->len;
+		char *key = klen < sizeof(buf) ? buf : malloc(klen+1);
 		if(!key)
 			return -1;
-		memcpy(key, s, klen);
-		// reuse var name
-		klen = callback(shm, key, di->ptr_value, user_data);
-		free(key);
-		if(klen)
-			return klen;
-		di = shpointer(shm, ptr_iter);
+		memcpy(key, k->str, klen+1);
+		int ret = callback(shm, key, klen, e->ptr_value, user_data);
+		if(key != buf)
+			free(key);
+		if(ret)
+			return ret;
 	}
 
 	return 0;
@@ -649,95 +1666,508 @@ int j_dict_iter(void *shm, long obj, int (*callback)(void *, char *, long, void
 /*
 	CMP functions
 */
-int j_cmp(void *shm, long a, long b)
+
+// `j_cmp`, with just the hashes kept (for the values of dicts/lists)
+static int _j_cmp(void *shm, long a, long b)
 {
-	struct j_value *ja = shpointer(shm, a);
-	struct j_value *jb = shpointer(shm, b);
-	int ta = ja->jtype;
-	int tb = jb->jtype;
+	int ta = j_type(shm, a);
+	int tb = j_type(shm, b);
 	if(ta!=tb)
-		// this also solves NULL, TRUE, FALSE
 		return 1;
 	switch(ta)
 	{
+		case JTYPE_NULL:
+		case JTYPE_TRUE:
+		case JTYPE_FALSE:
+			return 0;
 		case JTYPE_INT:
-			PD("cmp %d %d", ja->val_integer, jb->val_integer);
-			return ja->val_integer - jb->val_integer;
-		case JTYPE_FLOAT:
+			PD("cmp %ld %ld", j_int_val(shm, a), j_int_val(shm, b));
+			return j_int_val(shm, a) != j_int_val(shm, b);
+		case JTYPE_FLOAT: {
+			struct j_value *ja = shpointer(shm, a);
+			struct j_value *jb = shpointer(shm, b);
 			// because equal is 0
 			PD("cmp %f %f", ja->val_float, jb->val_float);
 			return !(ja->val_float == jb->val_float);
-		case JTYPE_STR:
-			PD("cmp '%s' '%s'", shpointer(shm, ja->str_val), shpointer(shm, jb->str_val));
-			return strcmp(shpointer(shm, ja->str_val), shpointer(shm, jb->str_val));
+		}
+		case JTYPE_STR: {
+			int la, lb;
+			char *sa = j_str_val(shm, a, &la);
+			char *sb = j_str_val(shm, b, &lb);
+			PD("cmp '%.*s' '%.*s'", la, sa, lb, sb);
+			if(la != lb)
+				return 1;
+			if(la > J_STR_INLINE && _j_str_hash(shm, a) != _j_str_hash(shm, b))
+				return 1;
+			return memcmp(sa, sb, la) != 0;
+		}
 		case JTYPE_LIST:
-			return j_list_cmp(shm, a,b);
-		case JTYPE_DICT:
-			return j_dict_cmp(shm, a,b);
+		case JTYPE_DICT: {
+			struct j_value *ja = shpointer(shm, a);
+			struct j_value *jb = shpointer(shm, b);
+			if(J_HASH_KEEPS(ja) && J_HASH_KEEPS(jb) && ja->list_hash != jb->list_hash)
+				return 1;
+			return ta == JTYPE_LIST ? j_list_cmp(shm, a, b) : j_dict_cmp(shm, a, b);
+		}
 	}
 	return -1;
 }
 
+int j_cmp(void *shm, long a, long b)
+{
+	// most different ones stop here
+	if(j_hash(shm, a) != j_hash(shm, b))
+		return 1;
+	return _j_cmp(shm, a, b);
+}
+
 int j_list_cmp(void *shm, long a, long b)
 {
 	struct j_value *ja = shpointer(shm, a);
 	struct j_value *jb = shpointer(shm, b);
 	if(ja->list_len != jb->list_len)
 		return 1;
-	long a_iter, b_iter;
-	struct j_list_item *la, *lb;
-	for(a_iter = ja->ptr_list_head, b_iter = jb->ptr_list_head; a_iter >=0; a_iter = la->ptr_next_item, b_iter = lb->ptr_next_item)
-	{
-		la = shpointer(shm, a_iter);
-		lb = shpointer(shm, b_iter);
-		if(j_cmp(shm, la->ptr_value, lb->ptr_value))
+	if(ja->ptr_list_buf == jb->ptr_list_buf)
+		// copies (see `j_copy`), or both empty
+		return 0;
+	for(int i = 0; i < ja->list_len; i++)
+		if(_j_cmp(shm, j_list_get(shm, a, i), j_list_get(shm, b, i)))
 			return 1;
-	}
 	return 0;
 }
 
-static int _dict_cmp(void *shm, char *key, long val_a, void *user_data)
-{
-	long b =*((long*)user_data);
-	// iterate over A, check value in B is equal
-	long val_b = j_dict_get(shm, b, key);
-	if(val_b < 0)
-		return 1;
-	return j_cmp(shm, val_a, val_b);
-}
-
 int j_dict_cmp(void *shm, long a, long b)
 {
 	struct j_value *ja = shpointer(shm, a);
 	struct j_value *jb = shpointer(shm, b);
 	if(ja->dict_len != jb->dict_len)
 		return 1;
-	return j_dict_iter(shm, a, _dict_cmp, &b);
+	if(ja->ptr_dict_table == jb->ptr_dict_table)
+		// copies (see `j_copy`), or both empty
+		return 0;
+	// iterate over A, check value in B is equal (keys are atoms in both)
+	struct j_dict_table *t = shpointer(shm, ja->ptr_dict_table);
+	for(int pos = 0; pos < t->used; pos++)
+	{
+		struct j_dict_entry *e = t->entries + pos;
+		if(e->key < 0)
+			continue;
+		int pos_b = _j_dict_find(shm, jb, e->key);
+		if(pos_b < 0)
+			return 1;
+		if(_j_cmp(shm, e->ptr_value, ((struct j_dict_table*)shpointer(shm, jb->ptr_dict_table))->entries[pos_b].ptr_value))
+			return 1;
+	}
+	return 0;
 }
 
 /*
 	HAS functions
 */
 
+// the value looked for, and its hash (compared first)
+struct j_search {
+	long value;
+	unsigned long hash;
+};
+
 static int _list_has(void *shm, int index, long val, void *search)
 {
+	struct j_search *s = search;
 	// return 1 if TRUE
-	return !j_cmp(shm, val, *((long*)search));
+	return j_hash(shm, val) == s->hash && !_j_cmp(shm, val, s->value);
 }
 
 int j_list_hasvalue(void *shm, long obj, long search)
 {
-	return j_list_iter(shm, obj, _list_has, &search);
+	struct j_search s = {search, j_hash(shm, search)};
+	return j_list_iter(shm, obj, _list_has, &s);
 }
 
-static int _dict_has(void *shm, char *key, long val, void *search)
+static int _dict_has(void *shm, char *key, int key_len, long val, void *search)
 {
-	return !j_cmp(shm, val, *((long*)search));
+	struct j_search *s = search;
+	return j_hash(shm, val) == s->hash && !_j_cmp(shm, val, s->value);
 }
 
 int j_dict_hasvalue(void *shm, long obj, long search)
 {
-	return j_dict_iter(shm, obj, _dict_has, &search);
+	struct j_search s = {search, j_hash(shm, search)};
+	return j_dict_iter(shm, obj, _dict_has, &s);
+}
+
+/*
+	HANDLERS
+
+	Handlers (`j:<id>`) are ids into a table, in the shared memory,
+	with the offsets of the objects, so these can move (see `j_compact`)
+
+	The id is the slot (+1) and, in the upper bits, its generation,
+	counting the times it was released, so a stale handler doesn't
+	get to whatever has the slot now
+
+	Free slots keep the next free one, as `-2 - slot`
+*/
+struct j_handle_slot {
+	long obj;
+	long gen;
+};
+
+struct j_handles {
+	long len;	// slots used (or freed)
+	long cap;
+	long free;	// first free slot, -1 if none
+	struct j_handle_slot slots[];
+};
+
+#define J_HANDLES_MIN	64
+
+#define J_HANDLE_SLOT_BITS	32
+#define J_HANDLE_SLOT_MASK	((1L << J_HANDLE_SLOT_BITS) - 1)
+// keeps the ids positive
+#define J_HANDLE_GEN_MASK	((1L << (63 - J_HANDLE_SLOT_BITS)) - 1)
+#define J_HANDLE_ID(t,slot)	((t)->slots[slot].gen << J_HANDLE_SLOT_BITS | ((slot) + 1))
+
+static struct j_handles *_j_handles(void *shm)
+{
+	long off = shmem_roots(shm)[J_ROOT_HANDLES];
+	return off < 0 ? NULL : shpointer(shm, off);
+}
+
+static long _j_handle_new(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	struct j_handles *t = _j_handles(shm);
+	if(!t || (t->free < 0 && t->len == t->cap))
+	{
+		// (re)allocate the table
+		long cap = t ? t->cap << 1 : J_HANDLES_MIN;
+		long off = shmalloc(shm, sizeof(struct j_handles) + cap * sizeof(struct j_handle_slot));
+		if(off < 0)
+			return -1;
+		struct j_handles *nt = shpointer(shm, off);
+		// after malloc, re-get pointers
+		t = _j_handles(shm);
+		if(t)
+		{
+			memcpy(nt, t, sizeof(struct j_handles) + t->len * sizeof(struct j_handle_slot));
+			shfree(shm, shmem_roots(shm)[J_ROOT_HANDLES]);
+		}
+		else
+		{
+			nt->len = 0;
+			nt->free = -1;
+		}
+		nt->cap = cap;
+		shmem_roots(shm)[J_ROOT_HANDLES] = off;
+		t = nt;
+	}
+	long slot;
+	if(t->free >= 0)
+	{
+		slot = t->free;
+		t->free = -2 - t->slots[slot].obj;
+	}
+	else
+	{
+		slot = t->len++;
+		t->slots[slot].gen = 0;
+	}
+	t->slots[slot].obj = obj;
+	jv = shpointer(shm, obj);
+	jv->handle = slot + 1;
+	// the handler keeps it (until `j_handle_drop`)
+	j_ref(shm, obj);
+	return J_HANDLE_ID(t, slot);
+}
+
+long j_handle(void *shm, long obj)
+{
+	if(J_IMMEDIATE(obj))
+		return -1;
+	struct j_value *jv = shpointer(shm, obj);
+	if(jv->handle)
+		return J_HANDLE_ID(_j_handles(shm), jv->handle - 1);
+	if(shmem_locked(shm) == SHMEM_LOCK_READ)
+		return -1;
+	return _j_handle_new(shm, obj);
+}
+
+int j_handle_needed(void *shm, long obj)
+{
+	if(J_IMMEDIATE(obj))
+		return 0;
+	struct j_value *jv = shpointer(shm, obj);
+	return J_COLLECTION(jv) && !jv->handle;
+}
+
+long j_handle_slot(void *shm, long handle)
+{
+	struct j_handles *t = _j_handles(shm);
+	long slot = (handle & J_HANDLE_SLOT_MASK) - 1;
+	if(!t || handle < 1 || slot < 0 || slot >= t->len)
+		return -1;
+	if(t->slots[slot].obj < 0 || t->slots[slot].gen != handle >> J_HANDLE_SLOT_BITS)
+		return -1;
+	return slot + 1;
+}
+
+long j_handle_get(void *shm, long handle)
+{
+	long slot = j_handle_slot(shm, handle);
+	return slot < 0 ? -1 : _j_handles(shm)->slots[slot-1].obj;
+}
+
+long j_handle_at(void *shm, long slot)
+{
+	struct j_handles *t = _j_handles(shm);
+	if(!t || slot < 1 || slot > t->len || t->slots[slot-1].obj < 0)
+		return -1;
+	return J_HANDLE_ID(t, slot - 1);
+}
+
+static void _j_handle_release(void *shm, long obj)
+{
+	struct j_value *jv = shpointer(shm, obj);
+	struct j_handles *t = _j_handles(shm);
+	long slot = jv->handle - 1;
+	t->slots[slot].obj = -2 - t->free;
+	// the next one to get it has another id
+	t->slots[slot].gen = (t->slots[slot].gen + 1) & J_HANDLE_GEN_MASK;
+	t->free = slot;
+	jv->handle = 0;
+}
+
+long j_handle_max(void *shm)
+{
+	struct j_handles *t = _j_handles(shm);
+	return t ? t->len : 0;
+}
+
+int j_handle_drop(void *shm, long handle)
+{
+	long obj = j_handle_get(shm, handle);
+	if(obj < 0)
+		return -1;
+	_j_handle_release(shm, obj);
+	j_free(shm, obj);
+	return 0;
+}
+
+/*
+	COMPACTION
+
+	Everything reachable from the handlers is copied, in order, to
+	another (empty) shared memory, which then replaces this one (see
+	`shmem_adopt`). The handlers stay the same, references are counted
+	again, from the links found (unreachable cycles are left behind).
+*/
+
+// objects already copied (old offset -> new offset), open addressing
+struct j_copy_map {
+	long *keys;
+	long *values;
+	unsigned long mask;
+	unsigned long len;
+};
+
+static unsigned long _j_map_hash(long key)
+{
+	return ((unsigned long)key >> 3) * 0x9e3779b97f4a7c15UL;
+}
+
+static long _j_map_get(struct j_copy_map *m, long key)
+{
+	if(!m->keys)
+		return -1;
+	unsigned long i;
+	for(i = _j_map_hash(key) & m->mask; m->keys[i] >= 0; i = (i+1) & m->mask)
+		if(m->keys[i] == key)
+			return m->values[i];
+	return -1;
+}
+
+static int _j_map_put(struct j_copy_map *m, long key, long value)
+{
+	unsigned long i;
+	if(!m->keys || (m->len+1)*2 > m->mask+1)
+	{
+		// grow it (keep it at most half full)
+		unsigned long cap = m->keys ? (m->mask+1)<<1 : 1024;
+		long *keys = (long*)malloc(cap * 2 * sizeof(long));
+		if(!keys)
+			return -1;
+		long *values = keys + cap;
+		for(i = 0; i < cap; i++)
+			keys[i] = -1;
+		for(unsigned long j = 0; m->keys && j <= m->mask; j++)
+		{
+			if(m->keys[j] < 0)
+				continue;
+			for(i = _j_map_hash(m->keys[j]) & (cap-1); keys[i] >= 0; i = (i+1) & (cap-1));
+			keys[i] = m->keys[j];
+			values[i] = m->values[j];
+		}
+		free(m->keys);
+		m->keys = keys;
+		m->values = values;
+		m->mask = cap-1;
+	}
+	for(i = _j_map_hash(key) & m->mask; m->keys[i] >= 0; i = (i+1) & m->mask);
+	m->keys[i] = key;
+	m->values[i] = value;
+	m->len++;
+	return 0;
+}
+
+static long _j_copy(void *shm, void *to, long obj, struct j_copy_map *m)
+{
+	// the same anywhere
+	if(J_IMMEDIATE(obj))
+		return obj;
+	struct j_value *jv = shpointer(shm, obj);
+	if(to == shm && !J_IN_ARENA(jv))
+		// in the same memory (see `_j_clone`), only nodes of arenas are copied
+		return J_COLLECTION(jv) ? _j_share(shm, obj) : j_ref(shm, obj);
+	long copy = _j_map_get(m, obj);
+	if(copy >= 0)
+		// one more reference to it (see `j_compact`)
+		return j_ref(to, copy);
+	switch(jv->jtype)
+	{
+		case JTYPE_INT:
+			copy = j_int_new(to, jv->val_integer);
+			break;
+		case JTYPE_FLOAT:
+			copy = j_float_new(to, jv->val_float);
+			break;
+		case JTYPE_STR: {
+			int len;
+			char *s = j_str_val(shm, obj, &len);
+			copy = j_str_new_len(to, s, len);
+			// the hash doesn't change either
+			if(copy >= 0 && !(jv->flags & JFLAG_INLINE))
+				((struct j_value*)shpointer(to, copy))->str_hash = jv->str_hash;
+			break;
+		}
+		case JTYPE_LIST:
+			copy = j_list_new(to);
+			break;
+		case JTYPE_DICT:
+			copy = j_dict_new(to);
+			break;
+	}
+	// before the items, they may (somehow) contain it
+	if(copy < 0 || _j_map_put(m, obj, copy))
+		return -1;
+	// same handlers, when it's to another memory (see `j_compact`)
+	if(to != shm)
+		((struct j_value*)shpointer(to, copy))->handle = jv->handle;
+	// tables shared by copies (see `j_copy`) are still shared there
+	long table = J_COLLECTION(jv) && jv->list_len && J_TABLE_REFS(shm, jv) > 1 ? jv->ptr_list_buf : -1;
+	if(J_COLLECTION(jv))
+		((struct j_value*)shpointer(to, copy))->flags |= jv->flags & JFLAG_LENT;
+	if(table >= 0)
+	{
+		struct j_value *cv = shpointer(to, copy);
+		cv->flags |= jv->flags & JFLAG_OWNER;
+		long shared = _j_map_get(m, table);
+		if(shared >= 0)
+		{
+			cv->ptr_list_buf = shared;
+			cv->list_len = jv->list_len;
+			cv->list_hash = jv->list_hash;
+			(*(int*)shpointer(to, shared))++;
+			return copy;
+		}
+	}
+	if(jv->jtype == JTYPE_LIST && jv->list_len)
+	{
+		// just the size needed
+		int cap = J_LIST_MIN;
+		while(cap < jv->list_len)
+			cap <<= 1;
+		if(_j_list_resize(to, copy, cap))
+			return -1;
+		for(int i = 0; i < j_list_len(shm, obj); i++)
+		{
+			long value = _j_copy(shm, to, j_list_get(shm, obj, i), m);
+			if(value < 0 || j_list_push(to, copy, value))
+				return -1;
+		}
+	}
+	else if(jv->jtype == JTYPE_DICT && jv->dict_len)
+	{
+		// just the size needed
+		int cap = J_DICT_MIN;
+		while(cap < jv->dict_len)
+			cap <<= 1;
+		if(_j_dict_resize(to, copy, cap))
+			return -1;
+		struct j_dict_table *t = shpointer(shm, jv->ptr_dict_table);
+		for(int pos = 0; pos < t->used; pos++)
+		{
+			struct j_dict_entry *e = t->entries + pos;
+			if(e->key < 0)
+				continue;
+			long value = _j_copy(shm, to, e->ptr_value, m);
+			if(value < 0)
+				return -1;
+			struct j_key *k = J_KEY(shm, e->key);
+			long key = _j_key_intern(to, k->str, k->len, k->hash);
+			// keys are unique already, no need to look for them
+			if(key < 0 || _j_dict_append(to, copy, key, value))
+				return -1;
+		}
+	}
+	if(table >= 0 && _j_map_put(m, table, ((struct j_value*)shpointer(to, copy))->ptr_list_buf))
+		return -1;
+	if(J_COLLECTION(jv))
+		// the same values, same hash (see `j_hash`)
+		((struct j_value*)shpointer(to, copy))->list_hash = jv->list_hash;
+	return copy;
+}
+
+// a copy (see `j_copy`), in the same memory
+static long _j_clone(void *shm, long obj)
+{
+	struct j_copy_map m = {NULL, NULL, 0, 0};
+	long copy = _j_copy(shm, shm, obj, &m);
+	free(m.keys);
+	return copy;
+}
+
+long j_compact(void *shm, void *to)
+{
+	struct j_copy_map m = {NULL, NULL, 0, 0};
+	struct j_handles *t = _j_handles(shm);
+	long ret = -1;
+	if(t)
+	{
+		// same table, with the new offsets
+		long off = shmalloc(to, sizeof(struct j_handles) + t->cap * sizeof(struct j_handle_slot));
+		if(off < 0)
+			goto _end;
+		shmem_roots(to)[J_ROOT_HANDLES] = off;
+		struct j_handles *nt = shpointer(to, off);
+		nt->len = t->len;
+		nt->cap = t->cap;
+		nt->free = t->free;
+		for(long i = 0; i < t->len; i++)
+		{
+			long obj = t->slots[i].obj;
+			if(obj >= 0 && (obj = _j_copy(shm, to, obj, &m)) < 0)
+				goto _end;
+			// may have moved
+			nt = _j_handles(to);
+			nt->slots[i].obj = obj;
+			nt->slots[i].gen = t->slots[i].gen;
+		}
+	}
+	ret = shmem_adopt(shm, to);
+_end:
+	free(m.keys);
+	return ret;
 }
 
 /*
@@ -751,6 +2181,7 @@ struct parser_ll {
 	union {
 		struct {
 			long ptr_dict;
+			// a copy, the parser reuses its buffers before the value comes
 			char* key;
 			size_t key_len;
 		};
@@ -781,31 +2212,30 @@ static int _parser_callback(JSON_TYPE type, const char *value, size_t size, void
 		obj = j_bool_new(pd->shm, type==JSON_TRUE);
 		break;
 	case JSON_NUMBER: {
-		int a,b,c,d;
-		json_analyze_number(value, size, &a, &b, &c, &d);
-		if(c)	// we only really care about this one
+		int is_int;
+		int64_t int_val;
+		double double_val;
+		if(json_number_decode(value, size, &is_int, &int_val, &double_val))
 		{
-			// integer
-			obj = j_int_new(pd->shm, json_number_to_int64(value, size));
+			fprintf(stderr, "error: out of memory parsing number\n");
+			return 1;
 		}
+		if(is_int)
+			obj = j_int_new(pd->shm, int_val);
 		else
-		{
-			double double_val;
-			if(json_number_to_double(value, size, &double_val))
-			{
-				fprintf(stderr, "error: number is to big to fit on float\n");
-				return 1;
-			}
 			obj = j_float_new(pd->shm, double_val);
-		}
 		break;
 	}
 	case JSON_STRING:
-		obj = _j_str_new(pd->shm, value, size);
+		obj = j_str_new_len(pd->shm, value, size);
 		break;
 	case JSON_KEY: {
 		struct parser_ll *node = pd->tail;
-		node->key = value;
+		char *key = realloc(node->key, size+1);
+		if(!key)
+			return -2;
+		memcpy(key, value, size);
+		node->key = key;
 		node->key_len = size;
 		return 0;
 	}
@@ -856,12 +2286,14 @@ static int _parser_callback(JSON_TYPE type, const char *value, size_t size, void
 		pd->tail = node;
 		node->type = JTYPE_DICT;
 		node->ptr_dict = obj;
+		node->key = NULL;
 		break;
 	}
 	case JSON_OBJECT_END: {
 		struct parser_ll *save = pd->tail;
 		obj = pd->tail->ptr_dict;
 		pd->tail = pd->tail->prev;
+		free(save->key);
 		free(save);
 		return 0;
 	}
@@ -881,16 +2313,23 @@ static int _parser_callback(JSON_TYPE type, const char *value, size_t size, void
 			node = node->prev;
 		if(node)
 		{
+			int err;
 			PD("test 1");
 			if(node->type == JTYPE_LIST)
 			{
 				PD("test 1.2");
-				j_list_set(pd->shm, node->ptr_list, -1, obj);
+				err = j_list_set(pd->shm, node->ptr_list, -1, obj);
 			}
 			else
 			{
 				PD("test 1.3");
-				_j_dict_set(pd->shm, node->ptr_dict, node->key, node->key_len, obj);
+				err = j_dict_set_len(pd->shm, node->ptr_dict, node->key, node->key_len, obj);
+			}
+			if(err)
+			{
+				// the parent doesn't have it, the parse stops here
+				j_free(pd->shm, obj);
+				return -2;
 			}
 			PD("test 2");
 		}
@@ -899,21 +2338,48 @@ static int _parser_callback(JSON_TYPE type, const char *value, size_t size, void
 	return 0;
 }
 
-long j_parse_file(void *shm, FILE *file, int suppress_error)
+// the parser's defaults, but for the limits given (if any)
+static void _j_parse_config(JSON_CONFIG *config, struct j_parse_limits *limits)
+{
+	json_default_config(config);
+	if(!limits)
+		return;
+	config->max_total_len = limits->total_len;
+	config->max_string_len = limits->string_len;
+}
+
+// finish parsing (`err` from feeding it, if any), the document, -1 on errors
+static long _j_parse_end(JSON_PARSER *parser, struct parser_data *pd, int err, int suppress_error)
+{
+	JSON_INPUT_POS pos;
+	int fini = json_fini(parser, &pos);
+	if(!err)
+		err = fini;
+	if(err)
+	{
+		if(!suppress_error)
+			fprintf(stderr, "error parsing json, at line %d, column %d: %s\n", pos.line_number, pos.column_number, json_error_str(err));
+		if(pd->top_level >= 0)
+			j_free(pd->shm, pd->top_level);
+		return -1;
+	}
+	return pd->top_level;
+}
+
+static long _j_parse_file(void *shm, FILE *file, JSON_CONFIG *config, int suppress_error)
 {
 	JSON_PARSER parser;
 	JSON_CALLBACKS callbacks;
-	JSON_INPUT_POS pos;
-	char buffer[1024];
+	char buffer[65536];
 	struct parser_data user_data = {NULL, -1, shm};
 	callbacks.process = _parser_callback;
-	json_init(&parser, &callbacks, NULL, &user_data);
+	json_init(&parser, &callbacks, config, &user_data);
 	int l;
-	int err;
-	while(!feof(file))
+	int err = 0;
+	while(!err && !feof(file))
 	{
-		l = fread(buffer, 1, 1024, file);
-		if(l<1024 && ferror(file))
+		l = fread(buffer, 1, sizeof(buffer), file);
+		if(l<sizeof(buffer) && ferror(file))
 		{
 			if(user_data.top_level >= 0)
 				j_free(shm, user_data.top_level);
@@ -921,33 +2387,69 @@ long j_parse_file(void *shm, FILE *file, int suppress_error)
 				fprintf(stderr, "error reading from input\n");
 			return -1;
 		}
-		if((err = json_feed(&parser, buffer, l))!=0)
-		{
-			json_fini(&parser, &pos);
-			if(!suppress_error)
-				fprintf(stderr, "error parsing json, at line %d, column %d: %s\n", pos.line_number, pos.column_number, json_error_str(err));
-			if(user_data.top_level >= 0)
-				j_free(shm, user_data.top_level);
-			return -1;
-		}
+		err = json_feed(&parser, buffer, l);
 	}
-	if((err = json_fini(&parser, &pos))!=0)
+	return _j_parse_end(&parser, &user_data, err, suppress_error);
+}
+
+/*
+	all of it at once, the strings (without escapes) are copied
+	from it straight to the shared memory
+*/
+static long _j_parse_buffer(void *shm, const char *buffer, unsigned long len, JSON_CONFIG *config, int suppress_error)
+{
+	JSON_PARSER parser;
+	JSON_CALLBACKS callbacks;
+	struct parser_data user_data = {NULL, -1, shm};
+	callbacks.process = _parser_callback;
+	json_init(&parser, &callbacks, config, &user_data);
+	return _j_parse_end(&parser, &user_data, json_feed(&parser, buffer, len), suppress_error);
+}
+
+// from `file`, or from `buffer` if there's no file
+static long _j_parse(void *shm, FILE *file, const char *buffer, unsigned long len, int flags, struct j_parse_limits *limits)
+{
+	JSON_CONFIG config;
+	_j_parse_config(&config, limits);
+	int quiet = flags & J_PARSE_QUIET;
+	if(!(flags & J_PARSE_ARENA))
+		return file ? _j_parse_file(shm, file, &config, quiet) : _j_parse_buffer(shm, buffer, len, &config, quiet);
+	if(_j_arena_begin(shm))
 	{
-		if(!suppress_error)
-			fprintf(stderr, "error parsing json, at line %d, column %d: %s\n", pos.line_number, pos.column_number, json_error_str(err));
-		if(user_data.top_level>=0)
-			j_free(shm, user_data.top_level);
+		if(!quiet)
+			fprintf(stderr, "error creating arena\n");
 		return -1;
 	}
-	return user_data.top_level;
+	// on errors, the partial document is dropped with the arena
+	return _j_arena_end(shm, file ? _j_parse_file(shm, file, &config, quiet) : _j_parse_buffer(shm, buffer, len, &config, quiet));
 }
 
-long j_parse_buffer(void *shm, char *buffer, int len, int suppress_error)
+long j_parse_file_limits(void *shm, FILE *file, int flags, struct j_parse_limits *limits)
 {
-	FILE *file = fmemopen(buffer, len, "rb");
-	if(!file)
-		return -1;
-	long out = j_parse_file(shm, file, suppress_error);
-	fclose(file);
+	struct stat st;
+	if(fstat(fileno(file), &st) || !S_ISREG(st.st_mode) || !st.st_size || ftell(file))
+		// pipes and such are read as they come
+		return _j_parse(shm, file, NULL, 0, flags, limits);
+	char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fileno(file), 0);
+	if(map == MAP_FAILED)
+		return _j_parse(shm, file, NULL, 0, flags, limits);
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+	long out = _j_parse(shm, NULL, map, st.st_size, flags, limits);
+	munmap(map, st.st_size);
 	return out;
 }
+
+long j_parse_file(void *shm, FILE *file, int flags)
+{
+	return j_parse_file_limits(shm, file, flags, NULL);
+}
+
+long j_parse_buffer_limits(void *shm, char *buffer, unsigned long len, int flags, struct j_parse_limits *limits)
+{
+	return _j_parse(shm, NULL, buffer, len, flags, limits);
+}
+
+long j_parse_buffer(void *shm, char *buffer, int len, int flags)
+{
+	return j_parse_buffer_limits(shm, buffer, len, flags, NULL);
+}
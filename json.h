@@ -35,22 +35,66 @@
 #define JTYPE_FALSE	7
 
 /*
-	TODO implement REF COUNTING
+	Values are counted: the `new` functions (and `j_parse_*`) give one
+	reference to the caller, `j_ref` adds one, setting it into a
+	container gives one to the container (so the same value can be in
+	more than one) and `j_free` drops one, freeing it with the last
 */
 
+// flags for the parse functions
+#define J_PARSE_QUIET	1	// don't print errors
+#define J_PARSE_ARENA	2	// place the document in its own arena
+
+// limits of the parser, in bytes, 0 for none
+struct j_parse_limits {
+	unsigned long total_len;	// of the document, 10M by default
+	unsigned long string_len;	// of each string, 64K by default
+};
+
 // return -1 on error and prints the erron on STDERR
-long j_parse_buffer(void *shm, char *buffer, int len, int suppress_errors);
-long j_parse_file(void *shm, FILE *file, int suppress_errors);
+long j_parse_buffer(void *shm, char *buffer, int len, int flags);
+// regular files are mapped, and parsed all at once
+long j_parse_file(void *shm, FILE *file, int flags);
+// the same, with other limits (NULL for the defaults)
+long j_parse_buffer_limits(void *shm, char *buffer, unsigned long len, int flags, struct j_parse_limits *limits);
+long j_parse_file_limits(void *shm, FILE *file, int flags, struct j_parse_limits *limits);
 
 long j_null_new(void *);
 long j_bool_new(void *, int);
 long j_int_new(void *, long);
 long j_float_new(void *, double);
 long j_str_new(void *, char *);
+long j_str_new_len(void *, char *, int len);	// may have NULs in it
 long j_list_new(void *);
 long j_dict_new(void *);
+/*
+	new dict/list (`jtype`) in its own arena, whatever is added to it
+	later is not placed there, `j_free` on it releases the arena
+*/
+long j_arena_new(void *, int jtype);
 
-void j_free(void *, long);	// generic one
+long j_ref(void *, long);	// returns the same value
+void j_free(void *, long);	// generic one, drops a reference
+/*
+	A copy (with one reference), -1 on failure. Dicts and lists share
+	what's in them with the copy until either one changes (the copy
+	of documents in arenas is a full one). Values taken out of them
+	before the copy (with handlers, or set in other containers) are
+	not copied, changes to these may show in both
+*/
+long j_copy(void *, long);
+/*
+	before handing out values of a dict/list (not needed to change
+	it), so these are not the ones of the copies, and it knows these
+	may change (see `j_hash`), -1 on failure
+
+	This changes the table the copies share, so it needs the write
+	lock (see `shmem_lock`), -1 holding the read one (and it's needed)
+*/
+int j_unshare(void *, long);
+// !0 if `j_unshare` has anything to do
+int j_unshare_needed(void *, long);
+// these free right away, mostly internal
 void j_null_free(void *, long);	// actually useless
 void j_bool_free(void *, long);	// actually useless
 void j_int_free(void *, long);
@@ -59,27 +103,88 @@ void j_str_free(void *, long);
 void j_list_free(void *, long);
 void j_dict_free(void *, long);
 
-int j_type(void *, long);
+int j_type(void *, long);	// -1 if not valid
 
 long j_int_val(void *, long);
 double j_float_val(void *, long);
-char *j_str_val(void *, long);	// returns the pointer to shared memory, volatile
+/*
+	returns the pointer to shared memory, volatile, and the length in
+	`len` (if not NULL), the string is NUL terminated but may have
+	other NULs in it
+*/
+char *j_str_val(void *, long, int *len);
 
 long j_list_get(void *, long, int index);
 long j_dict_get(void *, long, char *key);
+long j_dict_get_len(void *, long, char *key, int key_len);
 
 int j_list_set(void *, long, int index, long value);	// works like update (at index) or append (index == -1)
 int j_dict_set(void *, long, char *key, long value);
+int j_dict_set_len(void *, long, char *key, int key_len, long value);
 
 int j_list_del(void *, long, int index);
 int j_dict_del(void *, long, char *key);
+int j_dict_del_len(void *, long, char *key, int key_len);
+
+/*
+	Lists work as queues too, with O(1) at both ends
+
+	`j_list_insert` puts the value before `index` (up to the length),
+	`j_list_pop` and `j_list_shift` take the last/first value out of
+	the list, with its reference (to `j_free`), -1 if empty
+*/
+int j_list_insert(void *, long, int index, long value);
+int j_list_push(void *, long, long value);
+int j_list_unshift(void *, long, long value);
+long j_list_pop(void *, long);
+long j_list_shift(void *, long);
 
 int j_list_len(void *, long);
 int j_dict_len(void *, long);
 
 // iterate functions, callback shall return !0 if wishes to stop the iteration
 int j_list_iter(void *, long, int (*callback)(void *shm, int index, long value, void *user_data), void *user_data);
-int j_dict_iter(void *, long, int (*callback)(void *shm, char *key, long value, void *user_data), void *user_data);
+int j_dict_iter(void *, long, int (*callback)(void *shm, char *key, int key_len, long value, void *user_data), void *user_data);
+
+/*
+	Handlers are ids (>0) for objects, that don't change when these
+	are moved (by `j_compact`), `j_handle` gives one (always the
+	same) to an object, -1 on failure. The handler has a reference
+	to it, until `j_handle_drop`, after that the id is never valid
+	again (even if its slot is reused)
+
+	Giving one changes the table, so it needs the write lock (see
+	`shmem_lock`), like `j_handle_drop`, -1 holding the read one (and
+	the object has none yet)
+*/
+long j_handle(void *, long);
+// !0 if the dict/list has no handler yet (`j_handle` gives it one)
+int j_handle_needed(void *, long);
+// the object of a handler, -1 if invalid (or freed)
+long j_handle_get(void *, long handle);
+// release the handler (and its reference), -1 if invalid
+int j_handle_drop(void *, long handle);
+// the highest handler slot used so far (may be released), 0 if none
+long j_handle_max(void *);
+// the slot (1 to `j_handle_max`) of a handler, -1 if invalid (or freed)
+long j_handle_slot(void *, long handle);
+// the handler in a slot, -1 if it's free
+long j_handle_at(void *, long slot);
+
+/*
+	Copy everything reachable from the handlers to `to` (a new, empty,
+	shared memory) and replace the contents of `shm` with it, objects
+	are packed together and the shared memory shrinks
+
+	returns the bytes reclaimed, -1 on failure (nothing changes)
+*/
+long j_compact(void *shm, void *to);
+
+/*
+	hash of the contents, the same for equal values (see `j_cmp`), dicts
+	and lists keep it, so it's cheap to get again (even after changes)
+*/
+unsigned long j_hash(void *, long);
 
 // compare functions return 0 if equal, !0 otherwise
 int j_cmp(void *, long, long);
@@ -0,0 +1,119 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "common.h"
+
+// a line, `name value`
+static void _stat(const char *name, unsigned long value)
+{
+	out_write(name, strlen(name));
+	out_char(' ');
+	out_number(value);
+}
+
+static int _jstat_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+	if(loptend)
+	{
+		builtin_usage();
+		return EX_USAGE;
+	}
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	struct shmem_stats st;
+	if(shmem_stats(shm, &st))
+	{
+		PE("failed to get stats");
+		return EXECUTION_FAILURE;
+	}
+
+	_stat("size", st.size);
+	_stat("live", st.live);
+	_stat("free", st.free);
+	_stat("largest_free", st.largest_free);
+	_stat("wilderness", st.wilderness);
+	_stat("blocks", st.blocks);
+	_stat("free_blocks", st.free_blocks);
+	_stat("allocs", st.allocs);
+	_stat("frees", st.frees);
+	_stat("slab_allocs", st.slab_allocs);
+	_stat("slab_frees", st.slab_frees);
+	_stat("expands", st.expands);
+	_stat("shrinks", st.shrinks);
+	char buf[64];
+	out_write(buf, snprintf(buf, sizeof(buf), "avg_walk %.2f\n", st.walks ? (double)st.walk_steps / st.walks : 0.0));
+
+	return EXECUTION_SUCCESS;
+}
+
+int jstat_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jstat_builtin, list);
+}
+
+int jstat_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jstat_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *jstat_doc[] = {
+	"jstat",
+	"",
+	"prints statistics of the shared memory, one per line",
+	"as `<name> <value>`, sizes in bytes:",
+	"size, live, free (in holes), largest_free, wilderness",
+	"(free at the end), blocks, free_blocks; and counters",
+	"(from all the processes): allocs, frees, slab_allocs,",
+	"slab_frees, expands, shrinks and avg_walk (blocks",
+	"looked at per free list search)",
+	NULL
+};
+
+struct builtin jstat_struct = {
+	"jstat",
+	jstat_builtin,
+	BUILTIN_ENABLED,
+	jstat_doc,
+	"jstat",
+	0
+};
@@ -37,7 +37,7 @@ static char *_type_map[] = {
 	"bool"
 };
 
-int jtype_builtin(WORD_LIST *list)
+static int _jtype_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -49,7 +49,7 @@ int jtype_builtin(WORD_LIST *list)
 
 	long obj = -1;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		PE("failed to open shared memory");
@@ -61,7 +61,6 @@ int jtype_builtin(WORD_LIST *list)
 		char *handler_str = list->word->word;
 		if(!is_handler(handler_str))
 		{
-			shmem_fini(shm);
 			PE("handler is not actually a handler");
 			return EX_USAGE;
 		}
@@ -71,7 +70,6 @@ int jtype_builtin(WORD_LIST *list)
 		obj = get_handler_stdin();
 	else
 	{
-		shmem_fini(shm);
 		return EX_USAGE;
 	}
 
@@ -80,18 +78,32 @@ int jtype_builtin(WORD_LIST *list)
 	if(obj<0)
 	{
 		PE("invalid handler");
-		shmem_fini(shm);
 		return EXECUTION_FAILURE;
 	}
 
-	printf("%s\n", _type_map[j_type(shm, obj)]);
-
-	shmem_fini(shm);
+	char *type = _type_map[j_type(shm, obj)];
+	out_write(type, strlen(type));
+	out_char('\n');
 
 	return EXECUTION_SUCCESS;
 }
 
-// no load/unload
+int jtype_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_READ, _jtype_builtin, list);
+}
+
+int jtype_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jtype_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jtype_doc[] = {
 	"jtype <handler>",
@@ -0,0 +1,91 @@
+/*
+ * bash-json
+ * <http://github.com/Wiguwbe/bash-json>
+ *
+ * Copyright (c) 2023 Tiago Teixeira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "common.h"
+
+static int _junload_builtin(WORD_LIST *list)
+{
+	if(no_options(list))
+		return EX_USAGE;
+
+	list = loptend;
+	if(!list)
+		return EX_USAGE;
+
+	void *shm = get_shm();
+	if(!shm)
+	{
+		PE("failed to open shared memory");
+		return EXECUTION_FAILURE;
+	}
+
+	int ret = EXECUTION_SUCCESS;
+	for(; list; list = list->next)
+	{
+		char *handler_str = list->word->word;
+		// the others are still released
+		if(!is_handler(handler_str) || j_handle_drop(shm, atol(handler_str+2)))
+		{
+			PE("invalid handler");
+			ret = EXECUTION_FAILURE;
+		}
+	}
+
+	return ret;
+}
+
+int junload_builtin(WORD_LIST *list)
+{
+	return run_locked(SHMEM_LOCK_WRITE, _junload_builtin, list);
+}
+
+int junload_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void junload_builtin_unload(char *s)
+{
+	fini_top_level();
+}
+
+char *junload_doc[] = {
+	"junload <handler>...",
+	"",
+	"release the handlers, the values are freed when",
+	"nothing else (handlers, dicts/lists) has them",
+	NULL
+};
+
+struct builtin junload_struct = {
+	"junload",
+	junload_builtin,
+	BUILTIN_ENABLED,
+	junload_doc,
+	"junload <handler>...",
+	0
+};
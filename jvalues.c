@@ -25,7 +25,7 @@
 
 #include "common.h"
 
-static int _iter_dict(void *shm, char *key, long value, void *ud)
+static int _iter_dict(void *shm, char *key, int key_len, long value, void *ud)
 {
 	print_handler(shm, value);
 	return 0;
@@ -37,7 +37,18 @@ static int _iter_list(void *shm, int index, long value, void *ud)
 	return 0;
 }
 
-int jvalues_builtin(WORD_LIST *list)
+// 1 (and stops) if a dict/list in it has no handler yet
+static int _needs_dict(void *shm, char *key, int key_len, long value, void *ud)
+{
+	return j_handle_needed(shm, value);
+}
+
+static int _needs_list(void *shm, int index, long value, void *ud)
+{
+	return j_handle_needed(shm, value);
+}
+
+static int _jvalues_builtin(WORD_LIST *list)
 {
 	if(no_options(list))
 		return EX_USAGE;
@@ -47,7 +58,7 @@ int jvalues_builtin(WORD_LIST *list)
 		if(list->next)
 			return EX_USAGE;
 
-	void *shm = shmem_init(shm_name);
+	void *shm = get_shm();
 	if(!shm)
 	{
 		fprintf(stderr, "error: failed to open shared memory\n");
@@ -79,6 +90,24 @@ int jvalues_builtin(WORD_LIST *list)
 		goto _usage;
 	}
 
+	if(read_locked())
+	{
+		// only if it gives what it has
+		if(j_unshare_needed(shm, obj))
+			return EX_NEEDS_WRITE;
+		if(j_type(shm, obj) == JTYPE_DICT && j_dict_iter(shm, obj, _needs_dict, NULL))
+			return EX_NEEDS_WRITE;
+		if(j_type(shm, obj) == JTYPE_LIST && j_list_iter(shm, obj, _needs_list, NULL))
+			return EX_NEEDS_WRITE;
+	}
+
+	// what it gives out is its own, not of its copies (see `jcopy`)
+	if(j_unshare(shm, obj))
+	{
+		PE("failed to unshare object");
+		goto _fail;
+	}
+
 	switch(j_type(shm, obj))
 	{
 	case JTYPE_DICT:
@@ -92,19 +121,31 @@ int jvalues_builtin(WORD_LIST *list)
 		goto _fail;
 	}
 
-	shmem_fini(shm);
-
 	return EXECUTION_SUCCESS;
 
 _usage:
-	shmem_fini(shm);
 	return EX_USAGE;
 _fail:
-	shmem_fini(shm);
 	return EXECUTION_FAILURE;
 }
 
-// no load/unload
+int jvalues_builtin(WORD_LIST *list)
+{
+	// giving handlers, or unsharing (see `jcopy`), takes the write lock
+	return run_locked(SHMEM_LOCK_READ, _jvalues_builtin, list);
+}
+
+int jvalues_builtin_load(char *s)
+{
+	if(init_top_level())
+		return 0;
+	return 1;
+}
+
+void jvalues_builtin_unload(char *s)
+{
+	fini_top_level();
+}
 
 char *jvalues_doc[] = {
 	"jvalues <handler>",
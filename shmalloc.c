@@ -38,34 +38,281 @@
 
 //static void _print_shmem(struct shmem *);
 
+/*
+	Segment layout
+
+	The shared memory starts with a header (`struct shmem_header`),
+	which keeps the free lists (bins), followed by the heap.
+
+	Every block starts with a word with its size (header included)
+	and 2 flags: if the block is in use and if the previous block is
+	in use.
+
+	Free blocks also keep the links for their free list (right after
+	the size word) and repeat their size on the last word (the boundary
+	tag), so `shfree` can find and merge with the previous block without
+	walking the heap.
+
+	Small sizes have a bin each (exact fit, no search), bigger sizes
+	are grouped by powers of 2.
+
+	Everything after `top` is unused space (the wilderness), freed
+	blocks next to it are merged back into it.
+
+	The pages of big free blocks, and of the wilderness, are given back
+	to the kernel (punched out of the file), and the file is truncated
+	when the wilderness gets much bigger than what is in use.
+*/
+
+#define SHMEM_MAGIC	0x336d68736e6f736aUL	// "jsonshm3"
+
+#define BLOCK_USED	1UL
+#define PREV_USED	2UL
+#define FLAGS_MASK	7UL
+
+#define BLOCK_HEAD	sizeof(unsigned long)
+#define MIN_BLOCK	32UL
+
+// free blocks at least this big get their pages released
+#define RELEASE_MIN	(64UL<<10)
+
+#define SMALL_BINS	64
+#define SMALL_LIMIT	(MIN_BLOCK + (SMALL_BINS<<3))
+#define LARGE_BINS	32
+#define NBINS	(SMALL_BINS + LARGE_BINS)
+
+/*
+	Slabs
+
+	Small fixed size objects (JSON nodes) live in slab pages, there
+	is a list of pages (with free objects) per size, in the header.
+
+	A slab page is a normal block, placed so that its data is aligned
+	to SLAB_PAGE, the page header is at the start of it and is found
+	by masking the offset of any object inside it, objects don't have
+	any header.
+
+	Objects are taken from the free list of the page (objects freed)
+	or by bumping `bump` (objects never used).
+*/
+#define SLAB_PAGE	(16UL<<10)
+#define SLAB_MAX	64UL
+#define SLAB_CLASSES	(SLAB_MAX>>3)
+
+struct shmem_slab {
+	unsigned long obj_size;
+	// list of pages with free objects, for this size
+	long next_page;
+	long prev_page;
+	// intrusive list of free objects
+	long free_list;
+	// next object that was never used
+	unsigned long bump;
+	unsigned long used;
+};
+
+#define SLAB_START	((sizeof(struct shmem_slab)+7)&~7UL)
+#define SLAB_END	(SLAB_PAGE - BLOCK_HEAD)
+
+/*
+	Arenas
+
+	An arena is a set of chunks where objects are allocated by just
+	bumping an offset, they are not freed individually, the whole arena
+	is released at once.
+
+	Chunks are blocks with the data aligned to ARENA_CHUNK, so the
+	chunk header (and the arena) of an object is found by masking its
+	offset. Big objects get a block of their own, linked to the arena.
+
+	The arena is identified by the offset of its user data, right after
+	the header of the first chunk.
+*/
+#define ARENA_CHUNK	(64UL<<10)
+#define ARENA_BIG	(ARENA_CHUNK>>2)
+
+struct shmem_arena {
+	// the arena this chunk belongs to
+	long arena;
+	// these are only kept on the first chunk
+	long next_chunk;
+	long big_blocks;
+	unsigned long bump;
+	unsigned long end;
+};
+
+#define ARENA_HEAD	((sizeof(struct shmem_arena)+7)&~7UL)
+
 struct shmem_block {
-	long next_offset;
 	unsigned long size;
+	// these 2 are only valid on free blocks
+	long next_free;
+	long prev_free;
 };
 
+struct shmem_header {
+	unsigned long magic;
+	// current size of the shared memory, and a counter of changes
+	// to it, for processes that keep it mapped (see `shmem_sync`)
+	unsigned long size;
+	unsigned long generation;
+	// end of the last block
+	unsigned long top;
+	// bit set if the bin is not empty
+	unsigned long binmap[(NBINS+63)>>6];
+	long bins[NBINS];
+	// slab pages with free objects, per size
+	long slabs[SLAB_CLASSES];
+	// for the user (see `shmem_roots`)
+	long roots[SHMEM_ROOTS];
+	// counters, from all processes (see `shmem_stats`)
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long slab_allocs;
+	unsigned long slab_frees;
+	unsigned long expands;
+	unsigned long shrinks;
+	unsigned long walks;
+	unsigned long walk_steps;
+};
+
+#define HEAP_START	((sizeof(struct shmem_header)+7)&~7UL)
+
+#define SHMEM_DEFAULT_RESERVE	(1UL<<36)
+#define SHMEM_DEFAULT_GROW_MIN	(256UL<<10)
+#define SHMEM_DEFAULT_GROW_PERCENT	100
+
+// hugetlb pages, the default size on most systems
+#define SHMEM_HUGE_PAGE	(2UL<<20)
+
 struct shmem {
 	void *base_ptr;
 	int fd;
+	// backed by hugetlb pages (of `page` bytes)
+	int hugetlb;
+	unsigned long page;
 	unsigned long size;
+	// length of the mapping (virtual), `size` grows inside it
+	unsigned long reserve;
+	// last seen `generation` from the header
+	unsigned long generation;
+	// the lock held, 0 if none (see `shmem_locked`)
+	int locked;
 };
 
+/*
+	Growth policy (per process, see `shmem_configure`)
+*/
+static unsigned long _cfg_reserve = SHMEM_DEFAULT_RESERVE;
+static unsigned long _cfg_grow_min = SHMEM_DEFAULT_GROW_MIN;
+static unsigned _cfg_grow_percent = SHMEM_DEFAULT_GROW_PERCENT;
+
 #ifdef DEBUG
 #define PD(fmt, ...) fprintf(stderr, fmt "\n", __VA_ARGS__)
 #else
 #define PD(fmt, ...)
 #endif
 
+#define HEADER(h)	((struct shmem_header*)(h)->base_ptr)
+#define BLOCK(h, off)	((struct shmem_block*)((h)->base_ptr+(off)))
+#define BSIZE(b)	((b)->size&~FLAGS_MASK)
+#define FOOTER(h, off, size)	(*(unsigned long*)((h)->base_ptr+(off)+(size)-sizeof(unsigned long)))
+#define SLAB(h, off)	((struct shmem_slab*)((h)->base_ptr+(off)))
+#define ARENA(h, off)	((struct shmem_arena*)((h)->base_ptr+(off)))
+
+/*
+	Set the growth policy, values of 0 keep the current ones
+
+	Only affects memory initialized after this call
+*/
+void shmem_configure(unsigned long reserve, unsigned long grow_min, unsigned grow_percent)
+{
+	if(reserve)
+		_cfg_reserve = reserve;
+	if(grow_min)
+		_cfg_grow_min = grow_min;
+	if(grow_percent)
+		_cfg_grow_percent = grow_percent;
+}
+
+// round to the pages of the backing memory (may be huge pages)
+static unsigned long _page_round(struct shmem *h, unsigned long size)
+{
+	return (size + h->page - 1) & ~(h->page - 1);
+}
+
+/*
+	hugetlb pages are not there unless reserved, allocate them now
+	(and fail) instead of getting a SIGBUS when touching them
+*/
+static int _commit(struct shmem *h, unsigned long start, unsigned long end)
+{
+	if(!h->hugetlb)
+		return 0;
+	return fallocate(h->fd, 0, start, end - start);
+}
+
 /*
 	Init shared memory allocator
+
+	The whole reserve is mapped at once (without reserving swap or
+	memory), only the part up to the size of the shared memory is
+	usable, growing it is just a `ftruncate` and the base pointer
+	doesn't move.
 */
 void *shmem_init(char *name)
+{
+	return shmem_open(name, 0);
+}
+
+/*
+	memfd for the shared memory, with hugetlb pages if asked for
+	and there are any (reserved) for the first size
+*/
+static int _open_memfd(struct shmem *h, char *name, int flags)
+{
+	// it's just a label, no need for the slash
+	if(name[0] == '/')
+		name++;
+	if(flags & SHMEM_HUGETLB)
+	{
+		h->fd = memfd_create(name, MFD_CLOEXEC|MFD_HUGETLB);
+		if(h->fd >= 0)
+		{
+			h->hugetlb = 1;
+			h->page = SHMEM_HUGE_PAGE;
+			unsigned long size = _page_round(h, HEAP_START + _cfg_grow_min);
+			if(!ftruncate(h->fd, size) && !_commit(h, 0, size))
+				return 0;
+			close(h->fd);
+		}
+		// no hugetlb, go with regular pages
+		h->hugetlb = 0;
+		h->page = sysconf(_SC_PAGESIZE);
+	}
+	h->fd = memfd_create(name, MFD_CLOEXEC);
+	return h->fd < 0;
+}
+
+void *shmem_open(char *name, int flags)
 {
 	struct shmem *ret = (struct shmem*)malloc(sizeof(struct shmem));
 	struct stat stat;
 	int init_size = 0;
 	if(!ret)
 		return NULL;
-	if((ret->fd = shm_open(name, O_CREAT|O_RDWR, 0600)) < 0)
+	ret->hugetlb = 0;
+	ret->locked = 0;
+	ret->page = sysconf(_SC_PAGESIZE);
+	if(flags & SHMEM_MEMFD)
+	{
+		if(_open_memfd(ret, name, flags))
+		{
+			free(ret);
+			return NULL;
+		}
+	}
+	else if((ret->fd = shm_open(name, O_CREAT|O_RDWR, 0600)) < 0)
 	{
 		free(ret);
 		return NULL;
@@ -81,38 +328,100 @@ void *shmem_init(char *name)
 	// allocate HEAD
 	if(!ret->size)
 	{
-		if(ftruncate(ret->fd, sizeof(struct shmem_block)))
+		unsigned long size = _page_round(ret, HEAP_START + _cfg_grow_min);
+		if(ftruncate(ret->fd, size))
 		{
 			close(ret->fd);
 			free(ret);
 			return NULL;
 		}
-		ret->size = sizeof(struct shmem_block);
+		ret->size = size;
 	}
-	if((ret->base_ptr = mmap(NULL, ret->size, PROT_READ|PROT_WRITE, MAP_SHARED, ret->fd, 0))==MAP_FAILED)
+	// a memfd is new, even if hugetlb already gave it a size
+	if(flags & SHMEM_MEMFD)
+		init_size = 0;
+	ret->reserve = _page_round(ret, _cfg_reserve > ret->size ? _cfg_reserve : ret->size);
+	ret->base_ptr = mmap(NULL, ret->reserve, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_NORESERVE, ret->fd, 0);
+	if(ret->base_ptr==MAP_FAILED)
+	{
+		// not enough address space? fallback to map just what exists
+		ret->reserve = ret->size;
+		ret->base_ptr = mmap(NULL, ret->reserve, PROT_READ|PROT_WRITE, MAP_SHARED, ret->fd, 0);
+	}
+	if(ret->base_ptr==MAP_FAILED)
 	{
 		close(ret->fd);
 		free(ret);
 		return NULL;
 	}
+	// transparent huge pages, for when there are no hugetlb ones
+	if((flags & (SHMEM_THP|SHMEM_HUGETLB)) && !ret->hugetlb)
+		madvise(ret->base_ptr, ret->reserve, MADV_HUGEPAGE);
 	// setup HEAD
 	if(!init_size)
 	{
-		struct shmem_block *head = (struct shmem_block*)ret->base_ptr;
-		head->size = 0;
-		head->next_offset = -1;
+		struct shmem_header *head = HEADER(ret);
+		memset(head, 0, HEAP_START);
+		head->magic = SHMEM_MAGIC;
+		head->size = ret->size;
+		head->top = HEAP_START;
+		for(int i=0;i<NBINS;i++)
+			head->bins[i] = -1;
+		for(int i=0;i<SLAB_CLASSES;i++)
+			head->slabs[i] = -1;
+		for(int i=0;i<SHMEM_ROOTS;i++)
+			head->roots[i] = -1;
+	}
+	else if(HEADER(ret)->magic != SHMEM_MAGIC)
+	{
+		// not ours (or from an older version)
+		munmap(ret->base_ptr, ret->reserve);
+		close(ret->fd);
+		free(ret);
+		return NULL;
 	}
+	ret->generation = HEADER(ret)->generation;
 	return (void*)ret;
 }
 
+/*
+	Catch up with changes made by other processes
+
+	The mapping covers the whole reserve, so if the shared memory grew
+	we only need to update the size (and move the mapping if it grew
+	past the reserve), there are no system calls in the common case.
+*/
+int shmem_sync(void *handler)
+{
+	struct shmem *h = (struct shmem*)handler;
+	struct shmem_header *head = HEADER(h);
+	if(head->generation == h->generation)
+		return 0;
+	if(head->size > h->reserve)
+	{
+		unsigned long reserve = _page_round(h, head->size);
+		void *ptr = mremap(h->base_ptr, h->reserve, reserve, MREMAP_MAYMOVE);
+		if(ptr==MAP_FAILED)
+			return 1;
+		h->base_ptr = ptr;
+		h->reserve = reserve;
+		head = HEADER(h);
+	}
+	PD("shared memory changed from %ld to %ld", h->size, head->size);
+	h->size = head->size;
+	h->generation = head->generation;
+	return 0;
+}
+
 /*
 	closes the file descriptor and unmaps the memory
 */
 void shmem_fini(void *handler)
 {
 	struct shmem *h = (struct shmem*)handler;
-	munmap(h->base_ptr, h->size);
+	munmap(h->base_ptr, h->reserve);
 	close(h->fd);
+	free(h);
 }
 
 /*
@@ -127,28 +436,146 @@ int shmem_destroy(char *name)
 
 /*
 	utility function to expand the shared memory
-	and the MMAP.
+	to (at least) `needed` bytes.
+
+	It grows geometrically (see `shmem_configure`) so that
+	big loads only do a handful of these.
 
-	pointers after this function may be invalidated
+	Pointers are only invalidated if the reserve runs out
+	and the mapping needs to be moved
 */
-static int _expand_shm(struct shmem *handler, unsigned long size)
+static int _expand_shm(struct shmem *handler, unsigned long needed)
 {
-	void *ptr;
-	if(ftruncate(handler->fd, handler->size+size))
+	unsigned long new_size;
+	// someone else may have grown it already, never shrink it
+	if(shmem_sync(handler))
 		return 1;
-	// remap
-	ptr = mremap(handler->base_ptr, handler->size, handler->size+size, MREMAP_MAYMOVE);
-	if(ptr==MAP_FAILED)
+	if(needed <= handler->size)
+		return 0;
+	{
+		unsigned long step = handler->size / 100 * _cfg_grow_percent;
+		if(step < _cfg_grow_min)
+			step = _cfg_grow_min;
+		new_size = handler->size + step;
+		if(new_size < needed)
+			new_size = needed;
+		new_size = _page_round(handler, new_size);
+	}
+	if(new_size > handler->reserve)
+	{
+		// out of reserved space, move the mapping
+		unsigned long reserve = handler->reserve << 1;
+		if(reserve < new_size)
+			reserve = new_size;
+		void *ptr = mremap(handler->base_ptr, handler->reserve, reserve, MREMAP_MAYMOVE);
+		if(ptr==MAP_FAILED)
+			return 1;
+		handler->base_ptr = ptr;
+		handler->reserve = reserve;
+	}
+	if(ftruncate(handler->fd, new_size))
+		return 1;
+	if(_commit(handler, handler->size, new_size))
 	{
-		// reset shm size
 		ftruncate(handler->fd, handler->size);
 		return 1;
 	}
-	handler->size += size;
-	handler->base_ptr = ptr;
+	PD("expanded SHM from %ld to %ld", handler->size, new_size);
+	HEADER(handler)->expands++;
+	handler->size = new_size;
+	// let the other processes know
+	HEADER(handler)->size = new_size;
+	handler->generation = ++HEADER(handler)->generation;
 	return 0;
 }
 
+/*
+	BINS
+
+	bin index for a block size, small ones are exact (step 8),
+	large ones go by powers of 2 (starting at 512)
+*/
+static int _bin_index(unsigned long size)
+{
+	if(size < SMALL_LIMIT)
+		return (size - MIN_BLOCK) >> 3;
+	int i = SMALL_BINS + (63 - __builtin_clzl(size)) - 9;
+	return i < NBINS ? i : NBINS-1;
+}
+
+static void _bin_insert(struct shmem *h, long off, unsigned long size)
+{
+	struct shmem_header *head = HEADER(h);
+	int i = _bin_index(size);
+	struct shmem_block *b = BLOCK(h, off);
+	b->prev_free = -1;
+	b->next_free = head->bins[i];
+	if(b->next_free >= 0)
+		BLOCK(h, b->next_free)->prev_free = off;
+	head->bins[i] = off;
+	head->binmap[i>>6] |= 1UL<<(i&63);
+}
+
+static void _bin_remove(struct shmem *h, long off, unsigned long size)
+{
+	struct shmem_header *head = HEADER(h);
+	struct shmem_block *b = BLOCK(h, off);
+	if(b->prev_free >= 0)
+		BLOCK(h, b->prev_free)->next_free = b->next_free;
+	else
+	{
+		int i = _bin_index(size);
+		head->bins[i] = b->next_free;
+		if(b->next_free < 0)
+			head->binmap[i>>6] &= ~(1UL<<(i&63));
+	}
+	if(b->next_free >= 0)
+		BLOCK(h, b->next_free)->prev_free = b->prev_free;
+}
+
+/*
+	first non empty bin, starting at `i`, -1 if none
+*/
+static int _bin_next(struct shmem_header *head, int i)
+{
+	int w = i>>6;
+	unsigned long bits = head->binmap[w] & (~0UL << (i&63));
+	while(!bits)
+	{
+		if(++w >= ((NBINS+63)>>6))
+			return -1;
+		bits = head->binmap[w];
+	}
+	return (w<<6) + __builtin_ctzl(bits);
+}
+
+/*
+	mark a (free, out of any bin) block as used, splitting it
+	if what remains is big enough to be a block by itself
+*/
+static void _take_block(struct shmem *h, long off, unsigned long actual_size)
+{
+	struct shmem_block *b = BLOCK(h, off);
+	unsigned long size = BSIZE(b);
+	unsigned long prev_flag = b->size & PREV_USED;
+	if(size - actual_size >= MIN_BLOCK)
+	{
+		long rem = off + actual_size;
+		unsigned long rem_size = size - actual_size;
+		b->size = actual_size | BLOCK_USED | prev_flag;
+		BLOCK(h, rem)->size = rem_size | PREV_USED;
+		FOOTER(h, rem, rem_size) = rem_size;
+		_bin_insert(h, rem, rem_size);
+		// next block still has a free block before it
+	}
+	else
+	{
+		b->size = size | BLOCK_USED | prev_flag;
+		if(off + size < HEADER(h)->top)
+			BLOCK(h, off + size)->size |= PREV_USED;
+	}
+}
+
 /*
 	Allocates a memory block and returns an offset into the shared memory area
 
@@ -159,80 +586,163 @@ long shmalloc(void *handler, unsigned long size)
 	if(!size)
 		return -1;
 	struct shmem *h = (struct shmem*)handler;
-	unsigned long actual_size = size + sizeof(struct shmem_block);
-	unsigned long space_left = h->size;
-	unsigned long this_offset = 0;
+	unsigned long actual_size = size + BLOCK_HEAD;
 
 	// align 8
 	if(actual_size&7)
 		actual_size += 8-(actual_size&7);
+	if(actual_size < MIN_BLOCK)
+		actual_size = MIN_BLOCK;
+	HEADER(h)->allocs++;
 
-	// 1. check if there is space inside
-	/* with the HEAD, the size is always >0 */
+	// 1. look in the bins
 	{
-		long next_offset = -1;
-		struct shmem_block *block;
-		while(this_offset >= 0)
+		struct shmem_header *head = HEADER(h);
+		int i = _bin_index(actual_size);
+		head->walks++;
+		if(i >= SMALL_BINS)
 		{
-			block = shpointer(handler, this_offset);
-			// don't count holes
-			space_left = h->size - (this_offset + block->size + sizeof(struct shmem_block));
-			next_offset = block->next_offset;
-			if(next_offset>=0)
+			// large bins are not exact, first fit inside it
+			long off;
+			for(off = head->bins[i]; off >= 0; off = BLOCK(h, off)->next_free)
 			{
-				// check space between this one and the next one
-				unsigned long end_of_this = this_offset + block->size + sizeof(struct shmem_block);
-				unsigned long space_between = next_offset - end_of_this;
-				if(space_between >= actual_size)
+				head->walk_steps++;
+				if(BSIZE(BLOCK(h, off)) >= actual_size)
 				{
-					// we found it, cool
-					PD("found hole for new block at %ld (this_offset %d, actual_size %d, space_between %d)", end_of_this, this_offset, actual_size, space_between);
-					struct shmem_block *new_block = (struct shmem_block*)shpointer(handler, end_of_this);
-					new_block->size = actual_size - sizeof(struct shmem_block);
-					new_block->next_offset = next_offset;
-					block->next_offset = end_of_this;
-					return end_of_this + sizeof(struct shmem_block);
+					PD("found block in bin %d at %ld", i, off);
+					_bin_remove(h, off, BSIZE(BLOCK(h, off)));
+					_take_block(h, off, actual_size);
+					return off + BLOCK_HEAD;
 				}
-				// else, keep looking
-			}
-			// prepare for next iteration
-			if(next_offset<0)
-			{
-				// leave `this_offset` untouched
-				break;
 			}
-			this_offset = next_offset;
+			i++;
 		}
-		// nothing between blocks, check after the blocks
-		// look for space after the last one
-		if(space_left >= actual_size)
+		// exact small bin, or anything from the bigger bins
+		if(i < NBINS && (i = _bin_next(head, i)) >= 0)
 		{
-			unsigned long end_of_this = this_offset + block->size + sizeof(struct shmem_block);
-			PD("allocating block at end of memory %ld", end_of_this);
-			struct shmem_block *new_block = (struct shmem_block*)shpointer(handler, end_of_this);
-			new_block->size = actual_size - sizeof(struct shmem_block);
-			new_block->next_offset = -1;
-			struct shmem_block *prev_block = (struct shmem_block*)shpointer(handler, this_offset);
-			prev_block->next_offset = end_of_this;
-			return end_of_this + sizeof(struct shmem_block);
+			long off = head->bins[i];
+			head->walk_steps++;
+			PD("found block in bin %d at %ld", i, off);
+			_bin_remove(h, off, BSIZE(BLOCK(h, off)));
+			_take_block(h, off, actual_size);
+			return off + BLOCK_HEAD;
+		}
+	}
+	// 2. nothing free, use the space after `top`, expanding if needed
+	{
+		unsigned long top = HEADER(h)->top;
+		// another process may have changed (even shrunk) it
+		if(top + actual_size > h->size || h->generation != HEADER(h)->generation)
+		{
+			PD("expanding SHM to %ld bytes", top + actual_size);
+			if(_expand_shm(h, top + actual_size))
+				return -1;
+		}
+		// blocks before `top` are always in use (see `shfree`)
+		BLOCK(h, top)->size = actual_size | BLOCK_USED | PREV_USED;
+		HEADER(h)->top = top + actual_size;
+		return top + BLOCK_HEAD;
+	}
+}
+
+/*
+	Allocate a block with the data aligned to `align`, from a free
+	block big enough or else from `top`
+
+	The space skipped to align it becomes a free block
+*/
+static long _shmalloc_aligned(struct shmem *h, unsigned long actual_size, unsigned long align)
+{
+	HEADER(h)->allocs++;
+	// 1. look in the bins, for a block with an aligned region that fits
+	{
+		struct shmem_header *head = HEADER(h);
+		int i;
+		head->walks++;
+		for(i = _bin_next(head, _bin_index(actual_size)); i >= 0; i = i+1 < NBINS ? _bin_next(head, i+1) : -1)
+		{
+			long off;
+			for(off = head->bins[i]; off >= 0; off = BLOCK(h, off)->next_free)
+			{
+				head->walk_steps++;
+				unsigned long size = BSIZE(BLOCK(h, off));
+				unsigned long aligned = ((off + BLOCK_HEAD + align - 1) & ~(align - 1)) - BLOCK_HEAD;
+				if(aligned != off && aligned - off < MIN_BLOCK)
+					aligned += align;
+				if(aligned + actual_size > off + size)
+					continue;
+				PD("found aligned block in bin %d at %ld", i, off);
+				_bin_remove(h, off, size);
+				if(aligned != off)
+				{
+					// the space before it stays free
+					unsigned long gap = aligned - off;
+					BLOCK(h, off)->size = gap | (BLOCK(h, off)->size & PREV_USED);
+					FOOTER(h, off, gap) = gap;
+					_bin_insert(h, off, gap);
+					BLOCK(h, aligned)->size = size - gap;
+				}
+				_take_block(h, aligned, actual_size);
+				return aligned + BLOCK_HEAD;
+			}
 		}
 	}
-	// 2. either no space, or is empty, allocate more memory
+	// 2. from `top`
+	unsigned long top = HEADER(h)->top;
+	unsigned long off = ((top + BLOCK_HEAD + align - 1) & ~(align - 1)) - BLOCK_HEAD;
+	unsigned long prev_flag = PREV_USED;
+	if(off != top && off - top < MIN_BLOCK)
+		off += align;
+	if(off + actual_size > h->size || h->generation != HEADER(h)->generation)
 	{
-		// offset after last memory region, may still be inside the allocate region
-		unsigned long next_offset = h->size - space_left;
-		unsigned long to_expand = actual_size - space_left;
-		PD("expanding SHM by %d bytes (this_block%d, prev_block %d)", to_expand, next_offset, this_offset);
-		if(_expand_shm(h, to_expand))
+		if(_expand_shm(h, off + actual_size))
 			return -1;
-		// else, carry on
-		struct shmem_block *new_block = shpointer(h, next_offset);
-		new_block->size = actual_size - sizeof(struct shmem_block);
-		new_block->next_offset = -1;
-		struct shmem_block *prev_block = shpointer(h, this_offset);
-		prev_block->next_offset = next_offset;
-		return next_offset + sizeof(struct shmem_block);
 	}
+	if(off != top)
+	{
+		unsigned long gap = off - top;
+		BLOCK(h, top)->size = gap | PREV_USED;
+		FOOTER(h, top, gap) = gap;
+		_bin_insert(h, top, gap);
+		prev_flag = 0;
+	}
+	BLOCK(h, off)->size = actual_size | BLOCK_USED | prev_flag;
+	HEADER(h)->top = off + actual_size;
+	return off + BLOCK_HEAD;
+}
+
+/*
+	give the (whole) pages in [start, end) back to the kernel,
+	they read as zeros if used again
+*/
+static void _release(struct shmem *h, unsigned long start, unsigned long end)
+{
+	start = _page_round(h, start);
+	end &= ~(h->page - 1);
+	if(end <= start)
+		return;
+	PD("releasing %ld bytes at %ld", end - start, start);
+	if(fallocate(h->fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, start, end - start))
+		madvise(h->base_ptr + start, end - start, MADV_REMOVE);
+}
+
+/*
+	shrink the shared memory when the wilderness is most of it (or
+	`always`), keeping some room (`grow_min`) after `top`
+*/
+static void _trim_tail(struct shmem *h, int always)
+{
+	struct shmem_header *head = HEADER(h);
+	unsigned long keep = _page_round(h, head->top + _cfg_grow_min);
+	// only when it's less than a quarter, not to grow it right back
+	if(keep >= head->size || (!always && keep > head->size >> 2))
+		return;
+	if(ftruncate(h->fd, keep))
+		return;
+	PD("shrunk SHM from %ld to %ld", head->size, keep);
+	head->shrinks++;
+	h->size = head->size = keep;
+	h->generation = ++head->generation;
 }
 
 /*
@@ -241,41 +751,404 @@ long shmalloc(void *handler, unsigned long size)
 void shfree(void *handler, long offset)
 {
 	struct shmem *h = (struct shmem*)handler;
-	// because we have HEAD and the next structure, offset must always be:
-	if(offset<(sizeof(struct shmem_block)<<1) || offset >= h->size)
+	struct shmem_header *head = HEADER(h);
+	long off = offset - BLOCK_HEAD;
+	if(off < (long)HEAP_START || offset >= head->top)
+		return;
+	struct shmem_block *b = BLOCK(h, off);
+	if(!(b->size & BLOCK_USED))
+		// double free, ignore it
+		return;
+	head->frees++;
+	unsigned long size = BSIZE(b);
+#ifdef DEBUG
+	memset((void*)b + BLOCK_HEAD, 0, size - BLOCK_HEAD);
+#endif
+	// what to release, big free neighbours were already released
+	unsigned long rel_start = off, rel_end = off + size;
+	// merge with the previous one
+	if(!(b->size & PREV_USED))
+	{
+		unsigned long prev_size = *(unsigned long*)((void*)b - sizeof(unsigned long));
+		off -= prev_size;
+		size += prev_size;
+		_bin_remove(h, off, prev_size);
+		b = BLOCK(h, off);
+		if(prev_size < RELEASE_MIN)
+			rel_start = off;
+	}
+	// merge with the next one
+	if(off + size < head->top)
+	{
+		struct shmem_block *next = BLOCK(h, off + size);
+		if(!(next->size & BLOCK_USED))
+		{
+			unsigned long next_size = BSIZE(next);
+			_bin_remove(h, off + size, next_size);
+			size += next_size;
+			if(next_size < RELEASE_MIN)
+				rel_end = off + size;
+		}
+	}
+	if(off + size >= head->top)
+	{
+		// give it back to the wilderness
+		PD("merging %ld into top", off);
+		head->top = off;
+		_release(h, off, rel_end);
+		_trim_tail(h, 0);
 		return;
-	unsigned int this_offset = 0;
-	while(1)
+	}
+	b->size = size | (b->size & PREV_USED);
+	FOOTER(h, off, size) = size;
+	BLOCK(h, off + size)->size &= ~PREV_USED;
+	_bin_insert(h, off, size);
+	if(size >= RELEASE_MIN)
 	{
-		struct shmem_block *block = shpointer(handler, this_offset);
-		if(block->next_offset < 0)
-			break;
-		if(offset == (block->next_offset + sizeof(struct shmem_block)))
+		// keep the links and the boundary tag
+		if(rel_start < off + sizeof(struct shmem_block))
+			rel_start = off + sizeof(struct shmem_block);
+		if(rel_end > off + size - sizeof(unsigned long))
+			rel_end = off + size - sizeof(unsigned long);
+		_release(h, rel_start, rel_end);
+	}
+}
+
+/*
+	LOCKS
+
+	A POSIX record lock on byte 0 of the shared memory file. These
+	belong to the process, so forks don't share them, and the kernel
+	releases them when it exits, even if killed.
+*/
+
+int shmem_lock(void *handler, int mode)
+{
+	struct shmem *h = (struct shmem*)handler;
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = mode == SHMEM_LOCK_READ ? F_RDLCK : F_WRLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 1;
+	if(fcntl(h->fd, F_SETLKW, &fl))
+		return -1;
+	h->locked = mode;
+	return 0;
+}
+
+void shmem_unlock(void *handler, int mode)
+{
+	struct shmem *h = (struct shmem*)handler;
+	struct flock fl;
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = F_UNLCK;
+	fl.l_whence = SEEK_SET;
+	fl.l_start = 0;
+	fl.l_len = 1;
+	fcntl(h->fd, F_SETLK, &fl);
+	h->locked = 0;
+}
+
+int shmem_locked(void *handler)
+{
+	return ((struct shmem*)handler)->locked;
+}
+
+/*
+	STATS
+*/
+
+int shmem_stats(void *handler, struct shmem_stats *stats)
+{
+	struct shmem *h = (struct shmem*)handler;
+	if(shmem_sync(h))
+		return -1;
+	struct shmem_header *head = HEADER(h);
+	memset(stats, 0, sizeof(struct shmem_stats));
+	stats->size = head->size;
+	stats->wilderness = head->size - head->top;
+	// the blocks, in order
+	for(unsigned long off = HEAP_START; off < head->top; off += BSIZE(BLOCK(h, off)))
+	{
+		struct shmem_block *b = BLOCK(h, off);
+		if(b->size & BLOCK_USED)
 		{
-			// found it
-			struct shmem_block *target = shpointer(handler, block->next_offset);
-			block->next_offset = target->next_offset;
-			// no need to "free", but for debug purposes, we'll zero it
-			memset(target, 0, target->size + sizeof(struct shmem_block));
-			break;
+			stats->blocks++;
+			stats->live += BSIZE(b);
 		}
-		/* else */
-		if(offset < (block->next_offset + sizeof(struct shmem_block)))
+		else
 		{
-			// overshoot, it's invalid
-			break;
+			stats->free_blocks++;
+			stats->free += BSIZE(b);
+			if(BSIZE(b) > stats->largest_free)
+				stats->largest_free = BSIZE(b);
 		}
-		this_offset = block->next_offset;
 	}
-	// all cool
-	return;
+	stats->allocs = head->allocs;
+	stats->frees = head->frees;
+	stats->slab_allocs = head->slab_allocs;
+	stats->slab_frees = head->slab_frees;
+	stats->expands = head->expands;
+	stats->shrinks = head->shrinks;
+	stats->walks = head->walks;
+	stats->walk_steps = head->walk_steps;
+	return 0;
+}
+
+unsigned long shmem_size(void *handler)
+{
+	return HEADER((struct shmem*)handler)->size;
+}
+
+/*
+	ROOTS
+*/
+
+long *shmem_roots(void *handler)
+{
+	return HEADER((struct shmem*)handler)->roots;
+}
+
+/*
+	Replace the heap with the one from `from`
+*/
+long shmem_adopt(void *handler, void *from)
+{
+	struct shmem *h = (struct shmem*)handler;
+	struct shmem *f = (struct shmem*)from;
+	unsigned long old_top = HEADER(h)->top;
+	unsigned long new_top = HEADER(f)->top;
+	if(shmem_sync(h))
+		return -1;
+	if(new_top > h->size && _expand_shm(h, new_top))
+		return -1;
+	struct shmem_header *head = HEADER(h);
+	struct shmem_header *from_head = HEADER(f);
+	memcpy(h->base_ptr + HEAP_START, f->base_ptr + HEAP_START, new_top - HEAP_START);
+	head->top = new_top;
+	memcpy(head->binmap, from_head->binmap, sizeof(head->binmap));
+	memcpy(head->bins, from_head->bins, sizeof(head->bins));
+	memcpy(head->slabs, from_head->slabs, sizeof(head->slabs));
+	memcpy(head->roots, from_head->roots, sizeof(head->roots));
+	// the counters are this memory's, and it counts as one shrink
+	unsigned long shrinks = head->shrinks;
+	if(old_top > new_top)
+		_release(h, new_top, old_top);
+	_trim_tail(h, 1);
+	head->shrinks = shrinks + 1;
+	// contents changed, even if the size didn't
+	h->generation = ++head->generation;
+	return old_top > new_top ? old_top - new_top : 0;
+}
+
+/*
+	SLABS
+*/
+
+static void _slab_unlink(struct shmem *h, long page)
+{
+	struct shmem_slab *slab = SLAB(h, page);
+	if(slab->prev_page >= 0)
+		SLAB(h, slab->prev_page)->next_page = slab->next_page;
+	else
+		HEADER(h)->slabs[(slab->obj_size>>3)-1] = slab->next_page;
+	if(slab->next_page >= 0)
+		SLAB(h, slab->next_page)->prev_page = slab->prev_page;
+}
+
+static void _slab_link(struct shmem *h, long page)
+{
+	struct shmem_slab *slab = SLAB(h, page);
+	long *head = &HEADER(h)->slabs[(slab->obj_size>>3)-1];
+	slab->prev_page = -1;
+	slab->next_page = *head;
+	if(*head >= 0)
+		SLAB(h, *head)->prev_page = page;
+	*head = page;
+}
+
+/*
+	Allocate a small object (up to SLAB_MAX bytes), without a header
+
+	Free it with `shslab_free`, with the same size
+*/
+long shslab_alloc(void *handler, unsigned long size)
+{
+	struct shmem *h = (struct shmem*)handler;
+	if(!size)
+		return -1;
+	if(size > SLAB_MAX)
+		return shmalloc(handler, size);
+	size = (size + 7) & ~7UL;
+	HEADER(h)->slab_allocs++;
+	long page = HEADER(h)->slabs[(size>>3)-1];
+	struct shmem_slab *slab;
+	if(page < 0)
+	{
+		// new page
+		if((page = _shmalloc_aligned(h, SLAB_PAGE, SLAB_PAGE)) < 0)
+			return -1;
+		PD("new slab page for size %ld at %ld", size, page);
+		slab = SLAB(h, page);
+		slab->obj_size = size;
+		slab->free_list = -1;
+		slab->bump = SLAB_START;
+		slab->used = 0;
+		_slab_link(h, page);
+	}
+	slab = SLAB(h, page);
+	long obj;
+	if(slab->free_list >= 0)
+	{
+		obj = slab->free_list;
+		slab->free_list = *(long*)shpointer(h, obj);
+	}
+	else
+	{
+		obj = page + slab->bump;
+		slab->bump += size;
+	}
+	slab->used++;
+	// full?
+	if(slab->free_list < 0 && slab->bump + size > SLAB_END)
+		_slab_unlink(h, page);
+	return obj;
+}
+
+/*
+	Free a small object
+*/
+void shslab_free(void *handler, long offset, unsigned long size)
+{
+	struct shmem *h = (struct shmem*)handler;
+	if(size > SLAB_MAX)
+	{
+		shfree(handler, offset);
+		return;
+	}
+	if(offset < (long)SLAB_PAGE || offset >= HEADER(h)->top)
+		return;
+	long page = offset & ~(SLAB_PAGE-1);
+	struct shmem_slab *slab = SLAB(h, page);
+	HEADER(h)->slab_frees++;
+	int was_full = slab->free_list < 0 && slab->bump + slab->obj_size > SLAB_END;
+	*(long*)shpointer(h, offset) = slab->free_list;
+	slab->free_list = offset;
+	slab->used--;
+	if(was_full)
+		_slab_link(h, page);
+	else if(!slab->used && (slab->prev_page >= 0 || slab->next_page >= 0))
+	{
+		// empty, and not the only one for this size, give it back
+		PD("releasing slab page at %ld", page);
+		_slab_unlink(h, page);
+		shfree(handler, page);
+	}
+}
+
+/*
+	ARENAS
+*/
+
+/*
+	Create an arena, with `data_size` bytes for the user at the start
+	of it, returns the offset to those (which identifies the arena)
+*/
+long sharena_new(void *handler, unsigned long data_size)
+{
+	struct shmem *h = (struct shmem*)handler;
+	data_size = (data_size + 7) & ~7UL;
+	if(ARENA_HEAD + data_size > ARENA_BIG)
+		return -1;
+	long chunk = _shmalloc_aligned(h, ARENA_CHUNK, ARENA_CHUNK);
+	if(chunk < 0)
+		return -1;
+	struct shmem_arena *a = ARENA(h, chunk);
+	a->arena = chunk + ARENA_HEAD;
+	a->next_chunk = -1;
+	a->big_blocks = -1;
+	a->bump = chunk + ARENA_HEAD + data_size;
+	a->end = chunk + ARENA_CHUNK - BLOCK_HEAD;
+	PD("new arena at %ld", chunk);
+	return a->arena;
+}
+
+/*
+	Allocate from an arena
+*/
+long sharena_alloc(void *handler, long arena, unsigned long size)
+{
+	struct shmem *h = (struct shmem*)handler;
+	long first = arena - ARENA_HEAD;
+	if(!size)
+		return -1;
+	size = (size + 7) & ~7UL;
+	if(size > ARENA_BIG)
+	{
+		// a block of its own, linked to the arena
+		long big = shmalloc(handler, size + sizeof(long));
+		if(big < 0)
+			return -1;
+		*(long*)shpointer(h, big) = ARENA(h, first)->big_blocks;
+		ARENA(h, first)->big_blocks = big;
+		return big + sizeof(long);
+	}
+	struct shmem_arena *a = ARENA(h, first);
+	if(a->bump + size > a->end)
+	{
+		long chunk = _shmalloc_aligned(h, ARENA_CHUNK, ARENA_CHUNK);
+		if(chunk < 0)
+			return -1;
+		PD("new chunk for arena %ld at %ld", arena, chunk);
+		a = ARENA(h, first);
+		ARENA(h, chunk)->arena = arena;
+		ARENA(h, chunk)->next_chunk = a->next_chunk;
+		a->next_chunk = chunk;
+		a->bump = chunk + ARENA_HEAD;
+		a->end = chunk + ARENA_CHUNK - BLOCK_HEAD;
+	}
+	long obj = a->bump;
+	a->bump += size;
+	return obj;
+}
+
+/*
+	Release the whole arena, the cost is per chunk, not per object
+*/
+void sharena_free(void *handler, long arena)
+{
+	struct shmem *h = (struct shmem*)handler;
+	long first = arena - ARENA_HEAD;
+	long next;
+	for(long big = ARENA(h, first)->big_blocks; big >= 0; big = next)
+	{
+		next = *(long*)shpointer(h, big);
+		shfree(handler, big);
+	}
+	for(long chunk = ARENA(h, first)->next_chunk; chunk >= 0; chunk = next)
+	{
+		next = ARENA(h, chunk)->next_chunk;
+		shfree(handler, chunk);
+	}
+	shfree(handler, first);
+}
+
+/*
+	Arena of an object allocated by `sharena_alloc`
+	(not valid for big objects)
+*/
+long sharena_of(void *handler, long offset)
+{
+	return ARENA((struct shmem*)handler, offset & ~(ARENA_CHUNK-1))->arena;
 }
 
 /*
 	Get a pointer to the offset
 
-	These pointers are volatile, `shmalloc` may move
-	the base pointer and invalidate these ones
+	These pointers stay valid while the shared memory fits
+	the reserved mapping, `shmalloc` only moves the base
+	pointer when it runs out of it
 */
 void *shpointer(void *handler, long offset)
 {
@@ -306,217 +1179,73 @@ static void _print_shmem(struct shmem *handler)
 */
 #ifdef TEST
 
-/*
-	we can use only (unsigned) longs arrays
-	and to test it
-*/
+#include <sys/wait.h>
 
 /*
 	This tests mostly the shmalloc and shfree
 
 	Tests to execute:
-	A) no space left, expand and allocate in the expanded area
-	B) allocate in a hole
-	C) enough space at the end, allocate there
-	D) some space left, expand and allocate
+	A) empty bins, allocate after `top` (expanding)
+	B) allocate from an exact (small) bin
+	C) freeing next to `top` gives the memory back to it
+	D) free blocks merge with both neighbours (boundary tags)
+	E) large bins split the block and keep the rest
+	F) growing doesn't move the memory and grows more than needed
+	G) other handlers for the same memory see it grow
+	H) small objects are packed in slab pages, with no header
+	I) arenas bump allocate and release everything at once
+	J) free pages go back to the kernel, the memory shrinks
+	K) the heap (and roots) of another memory can be adopted
+	L) memfd memory is shared with forks, and has no name
+	M) stats add up
+	N) locks exclude other processes, and go away with them
 
-/*
 	Steps to execute:
 	1. init -> test empty/head
-	2. allocate 16 bytes, should expand the shared memory size (populate with AAA...) (does A))
-	3. allocate 16 bytes, should expand again (populate with BBB...) (does A) again)
-	4. free block from 2., should create empty hole (zeroed)
-	5. allocate 8 bytes, should use empty hole from 4. (populate with CCC...) (does B))
-	6. free block from 3., should create empty space at the end (24 bytes)
-	7. allocate 16 bytes, should use part of the available size (at the end) (populate with DDD...) (does C))
-	8. allocate 16 bytes, should use the rest of memory available and expand 8 bytes (populate with EEE...) (does D))
-	9. clear/finish
-*/
-
-#define TDS(td) sizeof(td)
-
-// 1. empty (just HEAD)
-static long td_1[] = {
-	// HEAD
-	-1,
-	0,
-	// DATA 0
-};
-static int td_1_s = TDS(td_1);
-
-// 2. allocate 16 bytes
-static long td_2[] = {
-	// HEAD
-	16,	// next offset
-	0,	// size
-	// NO DATA
-	// BLOCK 1
-	-1,	// next offset
-	16,	// size
-	// DATA 1
-	0x4141414141414141,
-	0x4141414141414141,
-};
-static int td_2_s = TDS(td_2);
-
-// 3. allocate 16 bytes (again)
-static long td_3[] = {
-	// HEAD
-	16,
-	0,
-	// BLOCK 1
-	48,	// next offset
-	16,	// size
-	// DATA 1
-	0x4141414141414141,
-	0x4141414141414141,
-	// BLOCK 2
-	-1,	// next offset
-	16,	// size
-	// DATA 2
-	0x4242424242424242,
-	0x4242424242424242,
-};
-static int td_3_s = TDS(td_3);
-
-// 4. free from 2.
-static long td_4[] = {
-	// HEAD
-	48,
-	0,
-	// EMPTY SPACE
-	0,
-	0,
-	0,
-	0,
-	// BLOCK 2
-	-1,
-	16,
-	0x4242424242424242,
-	0x4242424242424242,
-};
-static int td_4_s = TDS(td_4);
-
-// 5. allocate 8 bytes, use hole
-static long td_5[] = {
-	// HEAD
-	16,
-	0,
-	// BLOCK 3
-	48,
-	8,
-	0x4343434343434343,
-	// EMPTY SPACE
-	0,
-	// BLOCK 2
-	-1,
-	16,
-	0x4242424242424242,
-	0x4242424242424242,
-};
-static int td_5_s = TDS(td_5);
-
-// 6. free block from 3.
-static long td_6[] = {
-	// HEAD
-	16,
-	0,
-	// BLOCK 3
-	-1,
-	8,
-	0x4343434343434343,
-	// EMPTY SPACE
-	0,
-	0,
-	0,
-	0,
-	0,
-};
-static int td_6_s = TDS(td_6);
-
-// 7, allocate 16 bytes
-static long td_7[] = {
-	// HEAD
-	16,
-	0,
-	// BLOCK 3
-	40,
-	8,
-	0x4343434343434343,
-	// BLOCK 4
-	-1,
-	16,
-	0x4444444444444444,
-	0x4444444444444444,
-	// empty space
-	0,
-};
-static int td_7_s = TDS(td_7);
-
-// 8. sllocate 16 bytes, should expand
-static long td_8[] = {
-	// HEAD
-	16,
-	0,
-	// BLOCK 3
-	40,
-	8,
-	0x4343434343434343,
-	// BLOCK 4
-	72,
-	16,
-	0x4444444444444444,
-	0x4444444444444444,
-	// BLOCK 5
-	-1,
-	16,
-	0x4545454545454545,
-	0x4545454545454545,
-};
-static int td_8_s = TDS(td_8);
-
-// 9. no data
+	2. allocate 16 bytes, at the start of the heap (does A))
+	3. allocate 16 bytes, right after it (does A) again)
+	4. free block from 2., goes to the first bin, 3. knows the previous is free
+	5. allocate 8 bytes, should use the block from 4. (does B))
+	6. free block from 3., should move `top` back (does C))
+	7. free block from 5., the heap is empty again (does C) again)
+	8. allocate 4 blocks of 40 bytes, free 1st, 3rd and 2nd, should be 1 block (does D))
+	9. allocate 136 bytes, should use the merged block from 8. (does B) again)
+	10. allocate 2000 bytes (and a guard), free it and allocate 1000 bytes, the rest stays in a bin (does E))
+	11. allocate more than what is left, should grow (does F))
+	12. open a 2nd handler, grow with the 1st, the 2nd should see it after a sync (does G))
+	13. allocate 3 slab objects of 16 bytes, free the 2nd and allocate again, should reuse it (does H))
+	14. allocate a 24 byte slab object, should be in another page (does H) again)
+	15. create an arena, allocate small objects (more than a chunk) and a big one, free it (does I))
+	16. free a big block, its pages are released, grow a lot and free it, shrinks back (does J))
+	17. adopt the heap of a 2nd memory, the counters stay (does K))
+	18. open a memfd one, write to it on a fork (does L))
+	19. get stats, blocks and free space cover the heap, allocating counts (does M))
+	20. lock, a fork waits for it, a fork that exits holding it releases it (does N))
+	21. clear/finish
+*/
 
-static char *_td_fill =
-	"AAAAAAAA"
-	"AAAAAAAA"
-	"BBBBBBBB"
-	"BBBBBBBB"
-	"CCCCCCCC"
-	"DDDDDDDD"
-	"DDDDDDDD"
-	"EEEEEEEE"
-	"EEEEEEEE"
-;
+#define H	HEAP_START
 
-static void _compare(struct shmem *mem, long *td, int td_s)
+static int _check(int number, struct shmem *mem, int cond, char *what)
 {
-	fprintf(stderr, "SHMEM\n");
+	if(cond)
+		return 0;
+	fprintf(stderr, "error: TEST CASE %d fails! (%s)\n", number, what);
 	_print_shmem(mem);
-	int td_ss = td_s / sizeof(long);
-	fprintf(stderr, "TD\n++++++++++++++++\n");
-	for(unsigned long offset=0, i=0; i<td_ss; i++, offset+=8)
-		fprintf(stderr, "%016lx: %016lx\n", offset, td[i]);
-	fprintf(stderr, "----------------\n");
+	return 1;
 }
 
-#define TEST_ALLOC(number, asize, fill) \
-	long tc_ ## number = shmalloc(shmem, (asize));\
-	if(tc_ ## number <0) { perror(#number ": failed to allocate memory\n"); goto _error; } \
-	memcpy(shpointer(shmem, tc_ ## number) , fill, asize); \
-	if(shmem->size!=td_ ## number ## _s || memcmp(shmem->base_ptr, td_ ## number , td_ ## number ## _s)) { \
-		fprintf(stderr, "error: TEST CASE " #number " fails! (%ld)\n", tc_ ## number ); \
-		_compare(shmem, td_ ## number , td_ ## number ## _s); \
-		goto _error; \
-	}
+#define CHECK(number, cond) \
+	if(_check(number, shmem, (cond), #cond)) goto _error;
 
-#define TEST_FREE(number, prev) \
-	shfree(shmem, tc_ ## prev ); \
-	if(shmem->size!=td_ ## number ## _s||memcmp(shmem->base_ptr, td_ ## number , td_ ## number ## _s)) { \
-		fprintf(stderr, "error: TEST CASE " #number " fails!\n"); \
-		_compare(shmem, td_ ## number , td_ ## number ## _s); \
-		goto _error; \
-	}
+#define TEST_ALLOC(number, var, asize, expected) \
+	long var = shmalloc(shmem, (asize));\
+	if(var <0) { perror(#number ": failed to allocate memory\n"); goto _error; } \
+	memset(shpointer(shmem, var), 0x40 + number, asize); \
+	CHECK(number, var == (expected))
+
+#define TEST_FREE(number, var) \
+	shfree(shmem, var);
 
 int main(int argc, char**argv)
 {
@@ -527,103 +1256,225 @@ int main(int argc, char**argv)
 		perror("1: failed to initialize:");
 		return 1;
 	}
-	if(shmem->size!=td_1_s||memcmp(shmem->base_ptr, td_1, td_1_s))
+	struct shmem_header *head = HEADER(shmem);
+	CHECK(1, head->magic == SHMEM_MAGIC)
+	CHECK(1, head->top == H && shmem->size >= H + SHMEM_DEFAULT_GROW_MIN)
+	CHECK(1, _bin_next(head, 0) < 0)
+	// 2. allocate 16 bytes
+	TEST_ALLOC(2, tc_2, 16, H + BLOCK_HEAD)
+	head = HEADER(shmem);
+	CHECK(2, head->top == H + MIN_BLOCK)
+	// 3. allocate 16 bytes, again
+	TEST_ALLOC(3, tc_3, 16, H + MIN_BLOCK + BLOCK_HEAD)
+	head = HEADER(shmem);
+	// 4. free from 2
+	TEST_FREE(4, tc_2)
+	CHECK(4, head->bins[0] == H)
+	CHECK(4, !(BLOCK(shmem, H + MIN_BLOCK)->size & PREV_USED))
+	CHECK(4, FOOTER(shmem, H, MIN_BLOCK) == MIN_BLOCK)
+	// 5. allocate in the bin
+	TEST_ALLOC(5, tc_5, 8, tc_2)
+	CHECK(5, head->bins[0] < 0 && _bin_next(head, 0) < 0)
+	CHECK(5, BLOCK(shmem, H + MIN_BLOCK)->size & PREV_USED)
+	// 6. free from 3.
+	TEST_FREE(6, tc_3)
+	CHECK(6, head->top == H + MIN_BLOCK)
+	// 7. free from 5.
+	TEST_FREE(7, tc_5)
+	CHECK(7, head->top == H && _bin_next(head, 0) < 0)
+	// 8. merge
+	TEST_ALLOC(8, tc_8a, 40, H + BLOCK_HEAD)
+	TEST_ALLOC(8, tc_8b, 40, H + 48 + BLOCK_HEAD)
+	TEST_ALLOC(8, tc_8c, 40, H + 96 + BLOCK_HEAD)
+	TEST_ALLOC(8, tc_8d, 40, H + 144 + BLOCK_HEAD)
+	head = HEADER(shmem);
+	TEST_FREE(8, tc_8a)
+	TEST_FREE(8, tc_8c)
+	TEST_FREE(8, tc_8b)
+	CHECK(8, head->bins[_bin_index(144)] == H)
+	CHECK(8, _bin_next(head, 0) == _bin_index(144))
+	CHECK(8, BSIZE(BLOCK(shmem, H)) == 144)
+	// 9. use the merged block
+	TEST_ALLOC(9, tc_9, 136, tc_8a)
+	CHECK(9, _bin_next(head, 0) < 0)
+	// 10. large
+	TEST_ALLOC(10, tc_10a, 2000, H + 192 + BLOCK_HEAD)
+	TEST_ALLOC(10, tc_10b, 8, H + 192 + 2008 + BLOCK_HEAD)
+	head = HEADER(shmem);
+	TEST_FREE(10, tc_10a)
+	CHECK(10, head->bins[_bin_index(2008)] == H + 192)
+	TEST_ALLOC(10, tc_10c, 1000, tc_10a)
+	CHECK(10, head->bins[_bin_index(2008-1008)] == H + 192 + 1008)
+	// 11. grow
+	void *base_11 = shmem->base_ptr;
+	unsigned long size_11 = shmem->size;
+	TEST_ALLOC(11, tc_11, size_11, H + 192 + 2008 + MIN_BLOCK + BLOCK_HEAD)
+	CHECK(11, shmem->base_ptr == base_11)
+	CHECK(11, shmem->size >= size_11 << 1)
+	// 12. sync
+	{
+		struct shmem *other = (struct shmem*)shmem_init("/dred");
+		CHECK(12, other && other->size == shmem->size)
+		unsigned long size = shmem->size;
+		TEST_ALLOC(12, tc_12, size, tc_11 + size_11 + BLOCK_HEAD)
+		CHECK(12, other->size == size)
+		CHECK(12, !shmem_sync(other) && other->size == shmem->size)
+		CHECK(12, !memcmp(shpointer(other, tc_12), shpointer(shmem, tc_12), size))
+		shmem_fini(other);
+	}
+	// 13. slabs
 	{
-		fprintf(stderr, "error: TEST CASE 1 fails!\n");
-		_compare(shmem, td_1, td_1_s);
-		goto _error;
+		long a = shslab_alloc(shmem, 16);
+		long b = shslab_alloc(shmem, 16);
+		long c = shslab_alloc(shmem, 12);
+		CHECK(13, (a & (SLAB_PAGE-1)) == SLAB_START)
+		CHECK(13, b == a + 16 && c == b + 16)
+		CHECK(13, HEADER(shmem)->slabs[1] == a - SLAB_START)
+		CHECK(13, SLAB(shmem, a - SLAB_START)->used == 3)
+		shslab_free(shmem, b, 16);
+		CHECK(13, shslab_alloc(shmem, 16) == b)
+		// 14.
+		long d = shslab_alloc(shmem, 24);
+		CHECK(14, (d & (SLAB_PAGE-1)) == SLAB_START && d != a)
+		CHECK(14, HEADER(shmem)->slabs[2] == d - SLAB_START)
+		// the pages are blocks
+		CHECK(14, BSIZE(BLOCK(shmem, d - SLAB_START - BLOCK_HEAD)) == SLAB_PAGE)
+		shslab_free(shmem, a, 16);
+		shslab_free(shmem, b, 16);
+		shslab_free(shmem, c, 16);
+		shslab_free(shmem, d, 24);
+		CHECK(14, SLAB(shmem, a - SLAB_START)->used == 0)
 	}
-	// 2. allocate 16 bytes
-//
-//	long tc_2 = shmalloc(shmem, 16);
-//	if(tc_2<0)
-//	{
-//		perror("2: failed to allocate memory\n");
-//		goto _error;
-//	}
-//	if(shmem->size!=td_2_s||memcmp(shmem->base_ptr, td_2, td_2_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 2 fails (%ld)!\n", tc_2);
-//		_compare(shmem, td_2, td_2_s);
-//		goto _error;
-//	}
-	TEST_ALLOC(2, 16, _td_fill)
-//	// 3. allocate 16 bytes, again
-//	long tc_3 = shmalloc(shmem, 16);
-//	if(tc_3 < 0)
-//	{
-//		perror("3: failed to allocate memory\n");
-//		goto _error;
-//	}
-//	if(shmem->size!=td_3_s||memcmp(shmem->base_ptr, td_3, td_3_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 3 fails!\n");
-//		_compare(shmem, td_3, td_3_s);
-//		goto _error;
-//	}
-	TEST_ALLOC(3, 16, _td_fill+16)
-//	// 4. free from 2
-//	shfree(shmem, tc_2);
-//	if(shmem->size!=td_4_s||memcmp(shmem->base_ptr, td_4, td_4_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 4 fails!\n");
-//		_compare(shmem, td_4, td_4_s);
-//		goto _error;
-//	}
-//
-	TEST_FREE(4, 2)
-//	// 5. allocate in hole
-//	long tc_5 = shmalloc(shmem, 8);
-//	if(tc_5<0)
-//	{
-//		perror("5: failed to allocate memory\n");
-//		goto _error;
-//	}
-//	if(shmem->size!=td_5_s||memcmp(shmem->base_ptr, td_5, td_5_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 5 fails!\n");
-//		_compare(shmem, td_5, td_5_s);
-//		goto _error;
-//	}
-	TEST_ALLOC(5, 8, _td_fill+32)
-//	// 6. free from 3.
-//	shfree(shmem, tc_3);
-//	if(shmem->size!=td_6_s||memcmp(shmem->base_ptr, td_6, td_6_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 6 fails!\n");
-//		_compare(shmem, td_6, td_6_s);
-//		goto _error;
-//	}
-	TEST_FREE(6, 3)
-//	// 7. allocate 16
-//	long tc_7 = shmalloc(shmem, 16);
-//	if(tc_7<0)
-//	{
-//		perror("7: failed to allocate memory\n");
-//		goto _error;
-//	}
-//	if(shmem->size!=td_7_s||memcmp(shmem->base_ptr, td_7, td_7_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 7 fails!\n");
-//		_compare(shmem, td_7, td_7_s);
-//		goto _error;
-//	}
-	TEST_ALLOC(7, 16, _td_fill+40)
-//	// 8. allocate 16
-//	long tc_8 = shmalloc(shmem, 16);
-//	if(tc_8<0)
-//	{
-//		perror("8: failed to allocate memory\n");
-//		goto _error;
-//	}
-//	if(shmem->size!=td_8_s||memcmp(shmem->base_ptr, td_8, td_8_s))
-//	{
-//		fprintf(stderr, "error: TEST CASE 8 fails!\n");
-//		_compare(shmem, td_8, td_8_s);
-//		goto _error;
-//	}
-	TEST_ALLOC(8, 16, _td_fill+56)
-	// 9 clean
+	// 15. arenas
+	{
+		unsigned long top = HEADER(shmem)->top;
+		long arena = sharena_new(shmem, 16);
+		CHECK(15, arena >= 0 && ((arena - ARENA_HEAD) & (ARENA_CHUNK-1)) == 0)
+		long a = sharena_alloc(shmem, arena, 20);
+		long b = sharena_alloc(shmem, arena, 8);
+		CHECK(15, a == arena + 16 && b == a + 24)
+		for(int i=0;i<(ARENA_CHUNK>>8)+1;i++)
+			b = sharena_alloc(shmem, arena, 256);
+		CHECK(15, (b & ~(ARENA_CHUNK-1)) != (a & ~(ARENA_CHUNK-1)))
+		CHECK(15, sharena_of(shmem, a) == arena && sharena_of(shmem, b) == arena)
+		CHECK(15, sharena_alloc(shmem, arena, ARENA_CHUNK) >= 0)
+		sharena_free(shmem, arena);
+		CHECK(15, HEADER(shmem)->top <= top + ARENA_CHUNK)
+		// freed chunks (not at the top) are reused for aligned blocks
+		arena = sharena_new(shmem, 16);
+		a = sharena_new(shmem, 16);
+		top = HEADER(shmem)->top;
+		sharena_free(shmem, arena);
+		CHECK(15, HEADER(shmem)->top == top)
+		b = sharena_new(shmem, 16);
+		CHECK(15, b == arena && HEADER(shmem)->top == top)
+		sharena_free(shmem, b);
+		sharena_free(shmem, a);
+	}
+	// 16. release memory
+	{
+		struct stat st;
+		long guard_a = shmalloc(shmem, 64);
+		long big = shmalloc(shmem, 1UL<<20);
+		long guard_b = shmalloc(shmem, 64);
+		memset(shpointer(shmem, big), 1, 1UL<<20);
+		fstat(shmem->fd, &st);
+		unsigned long blocks = st.st_blocks;
+		shfree(shmem, big);
+		fstat(shmem->fd, &st);
+		// all but (at most) 2 pages are gone, blocks are 512 bytes
+		CHECK(16, st.st_blocks + (((1UL<<20) - 2*shmem->page)>>9) <= blocks)
+		shfree(shmem, guard_b);
+		shfree(shmem, guard_a);
+		// a big one at the end grows it, freeing it shrinks it back
+		unsigned long top = HEADER(shmem)->top;
+		big = shmalloc(shmem, 64UL<<20);
+		CHECK(16, big >= 0 && shmem->size > (64UL<<20))
+		shfree(shmem, big);
+		CHECK(16, HEADER(shmem)->top == top && shmem->size == _page_round(shmem, top + _cfg_grow_min))
+		fstat(shmem->fd, &st);
+		CHECK(16, (unsigned long)st.st_size == shmem->size)
+	}
+	// 17. roots, adopt
+	{
+		CHECK(17, shmem_roots(shmem)[0] == -1 && shmem_roots(shmem)[SHMEM_ROOTS-1] == -1)
+		struct shmem *other = (struct shmem*)shmem_init("/dred2");
+		CHECK(17, other != NULL)
+		long a = shmalloc(other, 100);
+		strcpy(shpointer(other, a), "adopted");
+		shmem_roots(other)[0] = a;
+		unsigned long generation = HEADER(shmem)->generation;
+		struct shmem_stats before, after;
+		CHECK(17, !shmem_stats(shmem, &before))
+		CHECK(17, shmem_adopt(shmem, other) >= 0)
+		CHECK(17, shmem_roots(shmem)[0] == a && !strcmp(shpointer(shmem, a), "adopted"))
+		CHECK(17, HEADER(shmem)->top == HEADER(other)->top && HEADER(shmem)->generation != generation)
+		// the counters are kept
+		CHECK(17, !shmem_stats(shmem, &after) && after.allocs == before.allocs && after.frees == before.frees)
+		CHECK(17, after.slab_allocs == before.slab_allocs && after.slab_frees == before.slab_frees)
+		CHECK(17, after.expands == before.expands && after.shrinks == before.shrinks + 1)
+		CHECK(17, after.walks == before.walks && after.walk_steps == before.walk_steps)
+		shmem_fini(other);
+		shmem_destroy("/dred2");
+		// and it's usable
+		CHECK(17, shmalloc(shmem, 100) == a + 112)
+	}
+	// 18. memfd
+	{
+		struct shmem *other = (struct shmem*)shmem_open("/dred3", SHMEM_MEMFD|SHMEM_HUGETLB);
+		CHECK(18, other != NULL && shm_unlink("/dred3") < 0)
+		long a = shmalloc(other, 100);
+		pid_t pid = fork();
+		if(!pid)
+		{
+			strcpy(shpointer(other, a), "forked");
+			shmalloc(other, 1UL<<20);
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+		CHECK(18, !strcmp(shpointer(other, a), "forked"))
+		CHECK(18, !shmem_sync(other) && other->size > (1UL<<20))
+		shmem_fini(other);
+	}
+	// 19. stats
+	{
+		struct shmem_stats st;
+		CHECK(19, !shmem_stats(shmem, &st))
+		CHECK(19, HEAP_START + st.live + st.free + st.wilderness == st.size && st.size == shmem->size)
+		CHECK(19, st.allocs >= st.frees && st.walks > 0 && st.expands > 0 && st.shrinks > 0)
+		unsigned long allocs = st.allocs;
+		long a = shmalloc(shmem, 16);
+		CHECK(19, !shmem_stats(shmem, &st) && st.allocs == allocs + 1)
+		shfree(shmem, a);
+	}
+	// 20. locks
+	{
+		long flag = shmalloc(shmem, sizeof(long));
+		*(long*)shpointer(shmem, flag) = 0;
+		CHECK(20, !shmem_lock(shmem, SHMEM_LOCK_WRITE))
+		pid_t pid = fork();
+		if(!pid)
+		{
+			shmem_lock(shmem, SHMEM_LOCK_READ);
+			*(long*)shpointer(shmem, flag) = 1;
+			_exit(0);
+		}
+		usleep(100000);
+		CHECK(20, *(long*)shpointer(shmem, flag) == 0)
+		shmem_unlock(shmem, SHMEM_LOCK_WRITE);
+		waitpid(pid, NULL, 0);
+		CHECK(20, *(long*)shpointer(shmem, flag) == 1)
+		if(!(pid = fork()))
+		{
+			shmem_lock(shmem, SHMEM_LOCK_WRITE);
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+		CHECK(20, !shmem_lock(shmem, SHMEM_LOCK_READ))
+		shmem_unlock(shmem, SHMEM_LOCK_READ);
+		shfree(shmem, flag);
+	}
+	// 21 clean
 	shmem_fini(shmem);
 	shmem_destroy("/dred");
 
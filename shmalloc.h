@@ -36,6 +36,46 @@
 */
 void *shmem_init(char *name);
 
+/*
+	Same, with options
+
+	With SHMEM_MEMFD it's not a named shared memory, but a memfd (the
+	name is only a label), it's only shared with the forks of this
+	process, and goes away with them.
+
+	SHMEM_THP asks for transparent huge pages, SHMEM_HUGETLB for hugetlb
+	ones (memfd only), these fall back to transparent huge pages when
+	there aren't hugetlb pages available.
+*/
+#define SHMEM_MEMFD	1
+#define SHMEM_THP	2
+#define SHMEM_HUGETLB	4
+void *shmem_open(char *name, int flags);
+
+/*
+	Configure how the shared memory grows (for this process)
+
+	`reserve` is the size of the (virtual) mapping, the shared memory
+	can grow up to it without moving (and invalidating pointers).
+
+	When it needs to grow, it grows by `grow_percent` of the current
+	size, but never less than `grow_min` bytes.
+
+	Passing 0 keeps the current value, call it before `shmem_init`
+*/
+void shmem_configure(unsigned long reserve, unsigned long grow_min, unsigned grow_percent);
+
+/*
+	Update the handler with changes made to the shared
+	memory by other processes (it grew)
+
+	Handlers kept for long (e.g. across forks) should call
+	this before using it, it's cheap when nothing changed
+
+	returns !0 on failure
+*/
+int shmem_sync(void *handler);
+
 /*
 	Free handler
 
@@ -46,6 +86,79 @@ void *shmem_init(char *name);
 */
 void shmem_fini(void *handler);
 
+/*
+	Locking, between processes
+
+	The allocator itself doesn't lock, users of the memory take the
+	read lock to only read it, and the write lock to change it (this
+	includes allocating and freeing, and anything readers could be
+	looking at).
+
+	The locks belong to the process, and are released when it exits.
+	Call `shmem_sync` after locking.
+
+	returns !0 on failure (like interrupted)
+*/
+#define SHMEM_LOCK_READ	1
+#define SHMEM_LOCK_WRITE	2
+int shmem_lock(void *handler, int mode);
+void shmem_unlock(void *handler, int mode);
+// the lock this process holds (through the handler), 0 if none
+int shmem_locked(void *handler);
+
+/*
+	Statistics
+
+	The counters are kept in the shared memory, so these count what
+	all the processes did, the rest is found by walking the heap
+*/
+struct shmem_stats {
+	unsigned long size;	// of the shared memory
+	unsigned long live;	// bytes in used blocks (block headers and slab pages included)
+	unsigned long free;	// bytes in free blocks
+	unsigned long largest_free;
+	unsigned long wilderness;	// bytes after the last block
+	unsigned long blocks;	// used blocks
+	unsigned long free_blocks;
+	// calls to shmalloc/shfree (and the internal ones)
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long slab_allocs;
+	unsigned long slab_frees;
+	// times it grew/shrunk
+	unsigned long expands;
+	unsigned long shrinks;
+	// searches in the free lists, and blocks looked at
+	unsigned long walks;
+	unsigned long walk_steps;
+};
+
+// returns !0 on failure
+int shmem_stats(void *handler, struct shmem_stats *stats);
+// just the size, without walking the heap (as of the last sync)
+unsigned long shmem_size(void *handler);
+
+/*
+	Slots (in the shared memory) for the user to keep the offsets of
+	well known objects, all -1 when it's created
+
+	The pointer is valid as long as the other ones
+*/
+#define SHMEM_ROOTS	8
+long *shmem_roots(void *handler);
+
+/*
+	Replace everything in the shared memory (the heap, the roots) with
+	the contents of `from`, and shrink it to fit
+
+	This is what compaction uses: live objects are copied (compacted) to
+	another shared memory, then adopted back. Offsets change, the other
+	processes see it as a change (see `shmem_sync`)
+
+	returns the number of bytes reclaimed, or -1 on failure
+*/
+long shmem_adopt(void *handler, void *from);
+
 /*
 	Destroy the shared memory
 
@@ -72,11 +185,45 @@ long shmalloc(void *handler, unsigned long size);
 */
 void shfree(void *handler, long offset);
 
+/*
+	Allocate a small (up to 64 bytes) object, for things
+	like nodes of a structure.
+
+	These are packed in pages, with no header per object,
+	so they must be freed with `shslab_free` with the same
+	size used to allocate them.
+
+	Returns -1 on error
+*/
+long shslab_alloc(void *handler, unsigned long size);
+void shslab_free(void *handler, long offset, unsigned long size);
+
+/*
+	Arenas, for objects that are released all at once
+
+	`sharena_new` creates the arena, with `data_size` bytes (up to 16k)
+	for the caller at the start, the returned offset points to these
+	and identifies the arena.
+
+	`sharena_alloc` just bumps a pointer, objects are not freed, the
+	whole arena is, with `sharena_free`.
+
+	`sharena_of` returns the arena of an object (up to 16k) allocated
+	with `sharena_alloc`.
+
+	Return -1 on error
+*/
+long sharena_new(void *handler, unsigned long data_size);
+long sharena_alloc(void *handler, long arena, unsigned long size);
+void sharena_free(void *handler, long arena);
+long sharena_of(void *handler, long offset);
+
 /*
 	Get an absolute pointer to the memory block
 
-	Because the base address may change on a call to `shmalloc`,
-	these pointer SHOULD be short lived
+	The base address only changes on a call to `shmalloc` when
+	the reserve (see `shmem_configure`) runs out, still, these
+	pointers SHOULD be short lived
 */
 void *shpointer(void *handler, long offset);
 